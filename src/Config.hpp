@@ -30,8 +30,63 @@ static constexpr bool ValidationEnabled = true;
 static constexpr uint32_t StartingWindowWidth = 640;
 static constexpr uint32_t StartingWindowHeight = 480;
 
-const size_t ThreadCount = std::thread::hardware_concurrency() * 2 + 1;
-//const size_t ThreadCount = 1;
+// 0 means one worker per physical core, see Utils::CpuTopology.
+static constexpr size_t ThreadCount = 0;
+//static constexpr size_t ThreadCount = 1;
+
+// Run jobs on fibers, so jobs waiting on other jobs don't block their worker.
+static constexpr bool FibersEnabled = true;
+//static constexpr bool FibersEnabled = false;
+static constexpr size_t FiberStackSize = 1024 * 1024;
+
+// How long a worker with nothing to do but fibers waiting on something which
+// won't wake it, like a GPU fence, sleeps before checking them again, in
+// microseconds. It doubles from the first to the second while none are ready.
+static constexpr size_t FiberPollMinMicroseconds = 20;
+static constexpr size_t FiberPollMaxMicroseconds = 250;
+
+// How many times a JobPool may pass over a lower priority job before it must
+// run it anyways.
+static constexpr size_t JobAgingLimit = 16;
+
+// Jobs submitted from a job go to the submitting worker till it has this many
+// runnable jobs queued, after which they go to other workers.
+static constexpr size_t LocalQueueLimit = 64;
+
+// How many jobs' worth of memory to allocate up front, and how many free jobs
+// each thread caches before handing them over to the others, see
+// Utils::SlabAllocator. Fanning out 8192 jobs at a time on 16 workers peaked
+// at 18-22k live and retired jobs, so reserve enough that that never grows the
+// slab. Past that it grows 1024 jobs at a time.
+static constexpr size_t JobSlabReserve = 32 * 1024;
+static constexpr size_t JobMagazineSize = 64;
+
+// Threads for jobs which block, like file reads, so they don't take up a core
+// meant for compute, and how many such jobs may be queued. See
+// Jobs::BlockingWorkers. 0 threads has the Workers run them instead.
+static constexpr size_t BlockingThreadCount = 2;
+//static constexpr size_t BlockingThreadCount = 0;
+static constexpr size_t BlockingQueueCapacity = 256;
+
+// How many io_uring rings, each with a thread, AsyncIO spreads requests over,
+// and how many requests each may have in flight. Reads of up to IOBufferSize
+// go straight into one of IOBufferCount buffers registered with the kernel.
+static constexpr size_t IOThreadCount = 1;
+static constexpr size_t IOQueueDepth = 64;
+static constexpr size_t IOBufferCount = 32;
+static constexpr size_t IOBufferSize = 64 * 1024;
+
+// How many frames' worth of Utils::FrameArena memory we keep, so a frame's
+// allocations live till this many frames later, and how big each thread's
+// blocks of it are.
+static constexpr size_t FramesInFlight = 2;
+static constexpr size_t FrameArenaBlockSize = 256 * 1024;
+
+// How many zones each thread's Utils::Profiler ring holds, a power of two.
+// Only matters if built with CAM_RE_PROFILE. F12 writes what they hold to
+// ProfilerTracePath.
+static constexpr size_t ProfilerZonesPerThread = 64 * 1024;
+static constexpr const char* ProfilerTracePath = "CAM.trace.json";
 }
 }
 
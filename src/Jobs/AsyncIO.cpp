@@ -0,0 +1,749 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AsyncIO.hpp"
+#include "WorkerPool.hpp"
+#include "../Utils/Assert.hpp"
+#include "../Utils/Unused.hpp"
+
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * One allocation, cut into buffers which are registered with every ring. Held
+ * by requests using one, so it may outlive AsyncIO.
+ */
+class CAM::Jobs::IOBufferPool
+{
+	public:
+	inline IOBufferPool(size_t count, size_t size) : count(count), size(size)
+	{
+		if (count != 0)
+		{
+			memory = static_cast<char*>(::operator new(count * size, std::align_val_t(4096)));
+		}
+		for (size_t i = count; i > 0; --i)
+		{
+			freeBuffers.push_back(static_cast<int>(i - 1));
+		}
+	}
+
+	inline ~IOBufferPool()
+	{
+		if (memory != nullptr)
+		{
+			::operator delete(memory, std::align_val_t(4096));
+		}
+	}
+
+	IOBufferPool(const IOBufferPool&) = delete;
+	IOBufferPool(IOBufferPool&&) = delete;
+	IOBufferPool& operator=(const IOBufferPool&)& = delete;
+	IOBufferPool& operator=(IOBufferPool&&)& = delete;
+
+	[[nodiscard]] inline int Take()
+	{
+		std::unique_lock<std::mutex> lock(freeBuffersMutex);
+		if (freeBuffers.empty())
+		{
+			return -1;
+		}
+
+		int index = freeBuffers.back();
+		freeBuffers.pop_back();
+		return index;
+	}
+
+	inline void GiveBack(int index)
+	{
+		std::unique_lock<std::mutex> lock(freeBuffersMutex);
+		freeBuffers.push_back(index);
+	}
+
+	[[nodiscard]] inline char* Buffer(int index) { return memory + static_cast<size_t>(index) * size; }
+
+	const size_t count;
+	const size_t size;
+
+	private:
+	char* memory = nullptr;
+	std::mutex freeBuffersMutex;
+	std::vector<int> freeBuffers;
+};
+
+/*
+ * One io_uring and the thread which drives it. We talk to the kernel directly,
+ * there's little enough of it that liburing isn't worth depending on.
+ *
+ * The thread always has a read of wakeFd in flight, which Queue writes to, so
+ * one io_uring_enter both submits what we have and sleeps till either
+ * something completes or more is queued.
+ */
+class CAM::Jobs::AsyncIO::Ring
+{
+	public:
+	Ring(AsyncIO* io, size_t queueDepth);
+	~Ring();
+
+	Ring(const Ring&) = delete;
+	Ring(Ring&&) = delete;
+	Ring& operator=(const Ring&)& = delete;
+	Ring& operator=(Ring&&)& = delete;
+
+	void Queue(std::shared_ptr<IORequest> request);
+
+	[[nodiscard]] inline bool UsingIOUring() const { return ringFd >= 0; }
+
+	private:
+	[[nodiscard]] bool SetUp(size_t queueDepth);
+	void TearDown();
+
+	void Routine();
+	void FallbackRoutine();
+
+	// False if we're done with request before getting to the kernel.
+	[[nodiscard]] bool Prepare(std::shared_ptr<IORequest>& request);
+
+	// Opens request's file here and now. False if we failed, and so are done.
+	[[nodiscard]] bool OpenNow(std::shared_ptr<IORequest>& request);
+
+	// For when the ring can't open files, so a slow open doesn't hold us up.
+	void OpenOnBlockingJob(std::shared_ptr<IORequest> request);
+	void Completed(size_t slot, int result);
+	void Finish(std::shared_ptr<IORequest> request, int error);
+
+	AsyncIO* io;
+
+	int wakeFd = -1;
+	uint64_t wakeValue = 0;
+
+	std::mutex pendingMutex;
+	std::deque<std::shared_ptr<IORequest>> pending;
+	std::atomic<bool> run = true;
+
+	// Only touched by our thread.
+	std::deque<std::shared_ptr<IORequest>> waiting;
+	std::vector<std::shared_ptr<IORequest>> inFlight; // Indexed by user_data - 1
+	std::vector<size_t> freeSlots;
+
+	int ringFd = -1;
+	bool fixedBuffers = false;
+	bool openAt = false;
+	unsigned sqEntries = 0;
+	void* sqRing = nullptr;
+	size_t sqRingSize = 0;
+	void* cqRing = nullptr;
+	size_t cqRingSize = 0;
+	io_uring_sqe* sqes = nullptr;
+	size_t sqesSize = 0;
+
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	io_uring_cqe* cqes;
+
+	std::thread thread;
+};
+
+namespace
+{
+int IOUringSetup(unsigned entries, io_uring_params* params)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IOUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int IOUringRegister(int fd, unsigned opcode, const void* arg, unsigned args)
+{
+	return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, args));
+}
+
+// The kernel writes tails and reads heads from the other side.
+inline unsigned LoadAcquire(unsigned* p) { return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire); }
+inline void StoreRelease(unsigned* p, unsigned v) { std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release); }
+
+constexpr uint64_t wakeUserData = 0;
+
+int OpenFlags(bool write)
+{
+	return write ? O_WRONLY | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC;
+}
+}
+
+CAM::Jobs::AsyncIO::Ring::Ring(AsyncIO* io, size_t queueDepth) : io(io)
+{
+	wakeFd = eventfd(0, EFD_CLOEXEC);
+	if (wakeFd < 0)
+	{
+		throw std::runtime_error("Could not create eventfd.");
+	}
+
+	if (SetUp(queueDepth))
+	{
+		inFlight.resize(sqEntries);
+		for (size_t i = sqEntries; i > 0; --i)
+		{
+			freeSlots.push_back(i - 1);
+		}
+		thread = std::thread(&Ring::Routine, this);
+	}
+	else
+	{
+		TearDown();
+		thread = std::thread(&Ring::FallbackRoutine, this);
+	}
+}
+
+CAM::Jobs::AsyncIO::Ring::~Ring()
+{
+	run.store(false, std::memory_order_release);
+	uint64_t one = 1;
+	MAYBE_UNUSED auto written = write(wakeFd, &one, sizeof(one));
+	thread.join();
+
+	TearDown();
+	close(wakeFd);
+}
+
+bool CAM::Jobs::AsyncIO::Ring::SetUp(size_t queueDepth)
+{
+	io_uring_params params = {};
+	ringFd = IOUringSetup(static_cast<unsigned>(queueDepth), &params);
+	if (ringFd < 0)
+	{
+		return false;
+	}
+
+	// IORING_OP_READ and WRITE are newer than io_uring itself.
+	std::vector<char> probeStorage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+	auto probe = reinterpret_cast<io_uring_probe*>(probeStorage.data());
+	if (IOUringRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) < 0)
+	{
+		return false;
+	}
+	auto supported = [probe] (unsigned op)
+	{
+		return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+	};
+	for (auto op : {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED})
+	{
+		if (!supported(op))
+		{
+			return false;
+		}
+	}
+
+	// Newer still, without it we open on blocking jobs.
+	openAt = supported(IORING_OP_OPENAT);
+
+	sqEntries = params.sq_entries;
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMmap)
+	{
+		sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+	}
+
+	sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		sqRing = nullptr;
+		return false;
+	}
+
+	if (singleMmap)
+	{
+		cqRing = sqRing;
+	}
+	else
+	{
+		cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			cqRing = nullptr;
+			return false;
+		}
+	}
+
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	auto sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqesMap == MAP_FAILED)
+	{
+		return false;
+	}
+	sqes = static_cast<io_uring_sqe*>(sqesMap);
+
+	auto sq = static_cast<char*>(sqRing);
+	sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+	auto cq = static_cast<char*>(cqRing);
+	cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	// Failing to register just means plain reads into the same memory.
+	auto& pool = *io->bufferPool;
+	if (pool.count != 0)
+	{
+		std::vector<iovec> iovecs(pool.count);
+		for (size_t i = 0; i < iovecs.size(); ++i)
+		{
+			iovecs[i].iov_base = pool.Buffer(static_cast<int>(i));
+			iovecs[i].iov_len = pool.size;
+		}
+		fixedBuffers = IOUringRegister(ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(iovecs.size())) >= 0;
+	}
+
+	return true;
+}
+
+void CAM::Jobs::AsyncIO::Ring::TearDown()
+{
+	if (sqes != nullptr) { munmap(sqes, sqesSize); sqes = nullptr; }
+	if (cqRing != nullptr && cqRing != sqRing) { munmap(cqRing, cqRingSize); }
+	cqRing = nullptr;
+	if (sqRing != nullptr) { munmap(sqRing, sqRingSize); sqRing = nullptr; }
+	if (ringFd >= 0) { close(ringFd); ringFd = -1; }
+}
+
+void CAM::Jobs::AsyncIO::Ring::Queue(std::shared_ptr<IORequest> request)
+{
+	{
+		std::unique_lock<std::mutex> lock(pendingMutex);
+		pending.push_back(std::move(request));
+	}
+
+	uint64_t one = 1;
+	MAYBE_UNUSED auto written = write(wakeFd, &one, sizeof(one));
+}
+
+void CAM::Jobs::AsyncIO::Ring::Routine()
+{
+	bool wakeArmed = false;
+	size_t inFlightCount = 0;
+
+	while (true)
+	{
+		bool stopping = !run.load(std::memory_order_acquire);
+		{
+			std::unique_lock<std::mutex> lock(pendingMutex);
+			for (auto& request : pending)
+			{
+				waiting.push_back(std::move(request));
+			}
+			pending.clear();
+		}
+
+		if (stopping)
+		{
+			for (auto& request : waiting)
+			{
+				Finish(std::move(request), ECANCELED);
+			}
+			waiting.clear();
+
+			if (inFlightCount == 0)
+			{
+				break;
+			}
+		}
+
+		unsigned tail = *sqTail;
+		unsigned mask = *sqMask;
+
+		if (!wakeArmed && !stopping)
+		{
+			auto& sqe = sqes[tail & mask];
+			std::memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = wakeFd;
+			sqe.addr = reinterpret_cast<uint64_t>(&wakeValue);
+			sqe.len = sizeof(wakeValue);
+			sqe.user_data = wakeUserData;
+			sqArray[tail & mask] = tail & mask;
+			++tail;
+			wakeArmed = true;
+		}
+
+		// Leave one entry for the wake read, and don't outrun the CQ.
+		while (!waiting.empty() && inFlightCount + 1 < sqEntries)
+		{
+			auto request = std::move(waiting.front());
+			waiting.pop_front();
+			if (!Prepare(request))
+			{
+				continue;
+			}
+
+			if (request->fd < 0 && !openAt)
+			{
+				OpenOnBlockingJob(std::move(request));
+				continue;
+			}
+
+			size_t slot = freeSlots.back();
+			freeSlots.pop_back();
+
+			auto& sqe = sqes[tail & mask];
+			std::memset(&sqe, 0, sizeof(sqe));
+			sqe.user_data = slot + 1;
+			request->opening = request->fd < 0;
+
+			size_t left = request->length - request->transferred;
+			if (request->opening)
+			{
+				// The path lives as long as the request, which we hold.
+				sqe.opcode = IORING_OP_OPENAT;
+				sqe.fd = AT_FDCWD;
+				sqe.addr = reinterpret_cast<uint64_t>(request->path.c_str());
+				sqe.len = 0644;
+				sqe.open_flags = static_cast<uint32_t>(OpenFlags(request->write));
+			}
+			else if (request->write)
+			{
+				sqe.opcode = IORING_OP_WRITE;
+			}
+			else if (fixedBuffers && request->bufferIndex >= 0)
+			{
+				sqe.opcode = IORING_OP_READ_FIXED;
+				sqe.buf_index = static_cast<uint16_t>(request->bufferIndex);
+			}
+			else
+			{
+				sqe.opcode = IORING_OP_READ;
+			}
+
+			if (!request->opening)
+			{
+				sqe.fd = request->fd;
+				sqe.off = request->offset + request->transferred;
+				sqe.addr = reinterpret_cast<uint64_t>(request->data + request->transferred);
+				sqe.len = static_cast<uint32_t>(std::min<size_t>(left, 1u << 30));
+			}
+			sqArray[tail & mask] = tail & mask;
+			++tail;
+
+			inFlight[slot] = std::move(request);
+			++inFlightCount;
+		}
+
+		// Along with what we queued just now, whatever the kernel didn't take
+		// last time, say because it ran short of memory.
+		StoreRelease(sqTail, tail);
+		unsigned toSubmit = tail - LoadAcquire(sqHead);
+		int ret = IOUringEnter(ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			throw std::runtime_error("io_uring_enter failed.");
+		}
+
+		unsigned head = *cqHead;
+		unsigned cqTailNow = LoadAcquire(cqTail);
+		for (; head != cqTailNow; ++head)
+		{
+			auto& cqe = cqes[head & *cqMask];
+			if (cqe.user_data == wakeUserData)
+			{
+				wakeArmed = false;
+				continue;
+			}
+
+			--inFlightCount;
+			Completed(static_cast<size_t>(cqe.user_data - 1), cqe.res);
+		}
+		StoreRelease(cqHead, head);
+	}
+}
+
+void CAM::Jobs::AsyncIO::Ring::FallbackRoutine()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pendingMutex);
+			for (auto& request : pending)
+			{
+				waiting.push_back(std::move(request));
+			}
+			pending.clear();
+		}
+
+		if (!run.load(std::memory_order_acquire))
+		{
+			for (auto& request : waiting)
+			{
+				Finish(std::move(request), ECANCELED);
+			}
+			waiting.clear();
+			break;
+		}
+
+		if (waiting.empty())
+		{
+			MAYBE_UNUSED auto got = read(wakeFd, &wakeValue, sizeof(wakeValue));
+			continue;
+		}
+
+		auto request = std::move(waiting.front());
+		waiting.pop_front();
+		if (!Prepare(request) || (request->fd < 0 && !OpenNow(request)))
+		{
+			continue;
+		}
+
+		while (true)
+		{
+			size_t left = request->length - request->transferred;
+			char* at = request->data + request->transferred;
+			off_t offset = static_cast<off_t>(request->offset + request->transferred);
+			ssize_t result = request->write ? pwrite(request->fd, at, left, offset) : pread(request->fd, at, left, offset);
+			if (result < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (result <= 0 || static_cast<size_t>(result) == left)
+			{
+				if (result > 0) { request->transferred += static_cast<size_t>(result); }
+				Finish(std::move(request), result < 0 ? errno : 0);
+				break;
+			}
+			request->transferred += static_cast<size_t>(result);
+		}
+	}
+}
+
+bool CAM::Jobs::AsyncIO::Ring::Prepare(std::shared_ptr<IORequest>& request)
+{
+	if (request->length == request->transferred)
+	{
+		Finish(std::move(request), 0);
+		return false;
+	}
+
+	return true;
+}
+
+bool CAM::Jobs::AsyncIO::Ring::OpenNow(std::shared_ptr<IORequest>& request)
+{
+	do
+	{
+		request->fd = open(request->path.c_str(), OpenFlags(request->write), 0644);
+	} while (request->fd < 0 && errno == EINTR);
+
+	if (request->fd < 0)
+	{
+		Finish(std::move(request), errno);
+		return false;
+	}
+
+	return true;
+}
+
+void CAM::Jobs::AsyncIO::Ring::OpenOnBlockingJob(std::shared_ptr<IORequest> request)
+{
+	io->opensInFlight.fetch_add(1, std::memory_order_relaxed);
+
+	auto job = io->wp->GetJob
+	(
+		[this, request] (WorkerPool*, size_t, Job*)
+		{
+			auto toOpen = request;
+			if (OpenNow(toOpen))
+			{
+				Queue(std::move(toOpen));
+			}
+			io->opensInFlight.fetch_sub(1, std::memory_order_release);
+		},
+		0,
+		false
+	);
+	job->SetBlocking();
+	if (!io->wp->SubmitJob(std::move(job))) { throw std::runtime_error("Could not submit job\n"); }
+}
+
+void CAM::Jobs::AsyncIO::Ring::Completed(size_t slot, int result)
+{
+	auto request = std::move(inFlight[slot]);
+	freeSlots.push_back(slot);
+
+	if (result == -EINTR || result == -EAGAIN)
+	{
+		waiting.push_front(std::move(request));
+		return;
+	}
+
+	// 0 is as good an fd as any.
+	if (request->opening)
+	{
+		if (result < 0)
+		{
+			Finish(std::move(request), -result);
+			return;
+		}
+
+		request->fd = result;
+		waiting.push_front(std::move(request));
+		return;
+	}
+
+	if (result <= 0)
+	{
+		Finish(std::move(request), -result);
+		return;
+	}
+
+	// Short, but not at the end of the file, so go again for the rest.
+	request->transferred += static_cast<size_t>(result);
+	if (request->transferred < request->length)
+	{
+		waiting.push_front(std::move(request));
+		return;
+	}
+
+	Finish(std::move(request), 0);
+}
+
+void CAM::Jobs::AsyncIO::Ring::Finish(std::shared_ptr<IORequest> request, int error)
+{
+	if (request->fd >= 0)
+	{
+		close(request->fd);
+		request->fd = -1;
+	}
+
+	request->error = error;
+	request->done.Signal();
+}
+
+CAM::Jobs::IORequest::~IORequest()
+{
+	if (bufferIndex >= 0)
+	{
+		bufferPool->GiveBack(bufferIndex);
+	}
+}
+
+CAM::Jobs::AsyncIO::AsyncIO
+(
+	WorkerPool* wp,
+	size_t threadCount,
+	size_t queueDepth,
+	size_t bufferCount,
+	size_t bufferSize
+) : wp(wp), bufferPool(std::make_shared<IOBufferPool>(bufferCount, bufferSize))
+{
+	ASSERT(threadCount != 0 && queueDepth > 1, "AsyncIO needs a thread and room for more than its wake up read.");
+
+	rings.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		rings.push_back(std::make_unique<Ring>(this, queueDepth));
+	}
+}
+
+CAM::Jobs::AsyncIO::~AsyncIO()
+{
+	// Their jobs are already submitted, so they'll be done soon enough.
+	while (opensInFlight.load(std::memory_order_acquire) != 0)
+	{
+		std::this_thread::yield();
+	}
+
+	rings.clear();
+}
+
+bool CAM::Jobs::AsyncIO::UsingIOUring() const
+{
+	return rings[0]->UsingIOUring();
+}
+
+std::shared_ptr<CAM::Jobs::IORequest> CAM::Jobs::AsyncIO::GetRead(std::string path, uint64_t offset, size_t length)
+{
+	std::shared_ptr<IORequest> request(new IORequest());
+	request->path = std::move(path);
+	request->offset = offset;
+	request->length = length;
+
+	if (length <= bufferPool->size)
+	{
+		request->bufferIndex = bufferPool->Take();
+	}
+	if (request->bufferIndex >= 0)
+	{
+		request->bufferPool = bufferPool;
+		request->data = bufferPool->Buffer(request->bufferIndex);
+	}
+	else
+	{
+		request->ownData.resize(length);
+		request->data = request->ownData.data();
+	}
+
+	return request;
+}
+
+std::shared_ptr<CAM::Jobs::IORequest> CAM::Jobs::AsyncIO::GetWrite(std::string path, uint64_t offset, std::vector<char> data)
+{
+	std::shared_ptr<IORequest> request(new IORequest());
+	request->write = true;
+	request->path = std::move(path);
+	request->offset = offset;
+	request->length = data.size();
+	request->ownData = std::move(data);
+	request->data = request->ownData.data();
+
+	return request;
+}
+
+void CAM::Jobs::AsyncIO::Submit(std::shared_ptr<IORequest> request)
+{
+	ASSERT(!request->submitted, "IORequests may only be submitted once.");
+	request->submitted = true;
+
+	size_t ring = nextRing.fetch_add(1, std::memory_order_relaxed) % rings.size();
+	rings[ring]->Queue(std::move(request));
+}
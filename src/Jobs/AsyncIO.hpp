@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous file reads and writes, which jobs can depend on.
+ *
+ * Like jobs, requests are got, depended on, then submitted. Get one with GetRead
+ * or GetWrite, have the jobs which need it DependsOn(request->Done()), then
+ * Submit it. Keep the request alive, say by capturing it, till they're done
+ * with it.
+ *
+ * Requests are spread over a few rings, each an io_uring with its own thread.
+ * Each thread takes every request queued since it last looked, submits them
+ * all in one go, and signals them as they complete. Files are opened through
+ * the ring too, or on a blocking job if the kernel can't, so a slow open never
+ * holds up a ring. Reads which fit go straight into buffers registered with
+ * the kernel up front, others into ones we allocate.
+ *
+ * Where io_uring is unavailable, say it's too old or disallowed, the ring's
+ * thread does the reads and writes itself. Slower, but still not on a Worker.
+ */
+
+#ifndef CAM_JOBS_ASYNCIO_HPP
+#define CAM_JOBS_ASYNCIO_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "JobCounter.hpp"
+
+namespace CAM
+{
+namespace Jobs
+{
+class WorkerPool;
+class AsyncIO;
+class IOBufferPool;
+
+class IORequest
+{
+	public:
+	~IORequest(); // Gives back our registered buffer, if we had one
+
+	IORequest(const IORequest&) = delete;
+	IORequest(IORequest&&) = delete;
+	IORequest& operator=(const IORequest&)& = delete;
+	IORequest& operator=(IORequest&&)& = delete;
+
+	// Signaled once we are done, successfully or not.
+	[[nodiscard]] inline JobEvent* Done() { return &done; }
+
+	// Only valid once Done is signaled. 0, or the errno we failed with.
+	[[nodiscard]] inline int Error() const { return error; }
+
+	// What was read, or written. Reads stop short at the end of the file.
+	[[nodiscard]] inline const char* Data() const { return data; }
+	[[nodiscard]] inline size_t Size() const { return transferred; }
+
+	private:
+	friend class AsyncIO;
+	IORequest() = default;
+
+	JobEvent done;
+	int error = 0;
+	bool submitted = false;
+
+	bool write = false;
+	std::string path;
+	uint64_t offset = 0;
+	size_t length = 0;
+	size_t transferred = 0;
+	int fd = -1;
+	bool opening = false; // Whether what's in flight is our open
+
+	char* data = nullptr;
+	std::vector<char> ownData;
+	std::shared_ptr<IOBufferPool> bufferPool;
+	int bufferIndex = -1; // Into the registered buffers, if we have one
+};
+
+class AsyncIO
+{
+	public:
+	AsyncIO(WorkerPool* wp, size_t threadCount, size_t queueDepth, size_t bufferCount, size_t bufferSize);
+	~AsyncIO(); // Waits for requests in flight, cancels the rest.
+
+	AsyncIO(const AsyncIO&) = delete;
+	AsyncIO(AsyncIO&&) = delete;
+	AsyncIO& operator=(const AsyncIO&)& = delete;
+	AsyncIO& operator=(AsyncIO&&)& = delete;
+
+	// Reads up to length bytes at offset.
+	[[nodiscard]] std::shared_ptr<IORequest> GetRead(std::string path, uint64_t offset, size_t length);
+
+	// Writes data at offset, creating the file if needed.
+	[[nodiscard]] std::shared_ptr<IORequest> GetWrite(std::string path, uint64_t offset, std::vector<char> data);
+
+	// Everything depending on request must do so before this.
+	void Submit(std::shared_ptr<IORequest> request);
+
+	// Whether we got io_uring, or fell back on plain reads and writes.
+	[[nodiscard]] bool UsingIOUring() const;
+
+	private:
+	class Ring;
+
+	WorkerPool* wp;
+
+	// Registered with every ring.
+	std::shared_ptr<IOBufferPool> bufferPool;
+
+	std::vector<std::unique_ptr<Ring>> rings;
+	std::atomic<size_t> nextRing = 0;
+
+	// Opens handed to blocking jobs, which queue their request on a ring once
+	// done. So the rings must outlive them.
+	std::atomic<size_t> opensInFlight = 0;
+};
+}
+}
+
+#endif
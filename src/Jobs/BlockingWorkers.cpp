@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BlockingWorkers.hpp"
+#include "WorkerPool.hpp"
+#include "Job.hpp"
+#include "../Utils/Assert.hpp"
+#include "../Utils/Epoch.hpp"
+#include "../Utils/Fiber.hpp"
+#include "../Utils/Profiler.hpp"
+#include "../Utils/Unused.hpp"
+
+thread_local size_t CAM::Jobs::BlockingWorkers::currentThreadNumber = CAM::Jobs::BlockingWorkers::notOurs;
+
+CAM::Jobs::BlockingWorkers::BlockingWorkers
+(
+	WorkerPool* owner,
+	size_t threadCount,
+	size_t queueCapacity,
+	size_t firstThreadNumber
+) : owner(owner), capacity(queueCapacity)
+{
+	ASSERT(threadCount != 0 && queueCapacity != 0, "BlockingWorkers need threads and room to queue.");
+
+	threads.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		threads.emplace_back(&BlockingWorkers::Routine, this, firstThreadNumber + i);
+	}
+}
+
+CAM::Jobs::BlockingWorkers::~BlockingWorkers()
+{
+	Stop();
+
+	std::unique_lock<std::mutex> lock(queueMutex);
+	for (auto job : queue)
+	{
+		delete job;
+	}
+	queue.clear();
+	queued.store(0, std::memory_order_relaxed);
+}
+
+void CAM::Jobs::BlockingWorkers::Stop()
+{
+	run.store(false, std::memory_order_release);
+	notEmpty.NotifyAll();
+	notFull.NotifyAll();
+
+	for (auto& thread : threads)
+	{
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
+}
+
+void CAM::Jobs::BlockingWorkers::Submit(std::unique_ptr<Job> job)
+{
+	ASSERT(job->CanRun(), "Only runnable jobs go to the BlockingWorkers.");
+
+	while (!TryPush(job, false))
+	{
+		if (job == nullptr)
+		{
+			return; // Dropped, we're dieing
+		}
+
+		// If all of us were to wait on ourselves we'd never drain. We're in a
+		// job, so outside the epoch, and Run expects to be in it.
+		if (currentThreadNumber != notOurs)
+		{
+			Utils::Epoch::Guard epoch;
+			Run(std::move(job), currentThreadNumber);
+			return;
+		}
+
+		auto pred = [this] { return !Full() || !run.load(std::memory_order_acquire); };
+		if (!Utils::Fiber::YieldUntil(pred, notFull))
+		{
+			notFull.Wait(pred);
+		}
+	}
+}
+
+void CAM::Jobs::BlockingWorkers::Push(std::unique_ptr<Job> job)
+{
+	ASSERT(job->CanRun(), "Only runnable jobs go to the BlockingWorkers.");
+	MAYBE_UNUSED bool pushed = TryPush(job, true);
+}
+
+// Either takes job, drops it if we've stopped, or leaves it be if we're full
+// and not forced.
+bool CAM::Jobs::BlockingWorkers::TryPush(std::unique_ptr<Job>& job, bool force)
+{
+	if (!run.load(std::memory_order_acquire))
+	{
+		job = nullptr;
+		return false;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		if (!force && Full())
+		{
+			return false;
+		}
+
+		queue.push_back(job.release());
+		queued.fetch_add(1, std::memory_order_release);
+	}
+
+	notEmpty.NotifyOne();
+	return true;
+}
+
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::BlockingWorkers::Pop()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	if (Empty())
+	{
+		return nullptr;
+	}
+
+	std::unique_ptr<Job> job(queue.front());
+	queue.pop_front();
+	queued.fetch_sub(1, std::memory_order_release);
+	lock.unlock();
+
+	notFull.NotifyOne();
+	return job;
+}
+
+void CAM::Jobs::BlockingWorkers::Routine(size_t threadNumber)
+{
+	currentThreadNumber = threadNumber;
+	CAM_PROFILE_THREAD("Blocking worker " + std::to_string(threadNumber));
+
+	Utils::Epoch::Guard epoch;
+	while (run.load(std::memory_order_acquire))
+	{
+		Utils::Epoch::Quiesce();
+
+		auto job = Pop();
+		if (job == nullptr)
+		{
+			Utils::Epoch::Leave();
+			notEmpty.Wait([this] { return !Empty() || !run.load(std::memory_order_acquire); });
+			Utils::Epoch::Enter();
+			continue;
+		}
+
+		Run(std::move(job), threadNumber);
+	}
+}
+
+void CAM::Jobs::BlockingWorkers::Run(std::unique_ptr<Job> job, size_t threadNumber)
+{
+	// Blocking jobs are the longest of all, so they mustn't hold up
+	// reclamation while they block.
+	Utils::Epoch::Leave();
+	std::unique_ptr<Job> next;
+	{
+		CAM_PROFILE_SCOPE("Blocking job");
+		next = job->DoJob(owner, threadNumber);
+	}
+	owner->ReturnJob(std::move(job));
+	Utils::Epoch::Enter();
+
+	// A dependent we made runnable, which we'd rather a Worker ran. It was
+	// counted again by that, so uncount it here.
+	if (next != nullptr)
+	{
+		if (!owner->SubmitJob(std::move(next))) { throw std::runtime_error("Could not submit job\n"); }
+		owner->JobFinished();
+	}
+
+	owner->JobFinished();
+}
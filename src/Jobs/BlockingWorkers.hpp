@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Threads for jobs which block, like file reads or waiting on a fence, so they
+ * don't stall a core meant for compute.
+ *
+ * Mark a job with SetBlocking before submitting it. Once it is runnable the
+ * WorkerPool hands it to us instead of a Worker, so Workers never see it. Jobs
+ * depending on it are made runnable as usual once it's done.
+ *
+ * The queue is bounded. Submitting to a full queue suspends the submitting
+ * fiber, or blocks the thread if there's none, till there's room. Jobs made
+ * runnable by their last dependency finishing skip the wait, since whoever
+ * finished it may be holding locks, and go over the bound instead. We don't
+ * use fibers ourselves; blocking is what we're for.
+ */
+
+#ifndef CAM_JOBS_BLOCKINGWORKERS_HPP
+#define CAM_JOBS_BLOCKINGWORKERS_HPP
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+#include "../Utils/EventCount.hpp"
+
+namespace CAM
+{
+namespace Jobs
+{
+class WorkerPool;
+class Job;
+
+class BlockingWorkers
+{
+	public:
+	// Our threads are numbered from firstThreadNumber up, as far as the jobs
+	// we run can tell.
+	BlockingWorkers(WorkerPool* owner, size_t threadCount, size_t queueCapacity, size_t firstThreadNumber);
+	~BlockingWorkers(); // Jobs still queued are dropped.
+
+	BlockingWorkers(const BlockingWorkers&) = delete;
+	BlockingWorkers(BlockingWorkers&&) = delete;
+	BlockingWorkers& operator=(const BlockingWorkers&)& = delete;
+	BlockingWorkers& operator=(BlockingWorkers&&)& = delete;
+
+	// job must be runnable, and already counted by the WorkerPool. Dropped
+	// once we've been stopped. Don't hold any locks, this may wait.
+	void Submit(std::unique_ptr<Job> job);
+
+	// Like Submit, but never waits, even if we are full.
+	void Push(std::unique_ptr<Job> job);
+
+	// Waits for our threads to finish their current jobs and leave.
+	void Stop();
+
+	[[nodiscard]] inline size_t ThreadCount() const { return threads.size(); }
+
+	private:
+	void Routine(size_t threadNumber);
+	void Run(std::unique_ptr<Job> job, size_t threadNumber);
+	[[nodiscard]] bool TryPush(std::unique_ptr<Job>& job, bool force);
+	[[nodiscard]] std::unique_ptr<Job> Pop();
+
+	[[nodiscard]] inline bool Full() const { return queued.load(std::memory_order_acquire) >= capacity; }
+	[[nodiscard]] inline bool Empty() const { return queued.load(std::memory_order_acquire) == 0; }
+
+	WorkerPool* owner;
+
+	std::mutex queueMutex;
+	std::deque<Job*> queue;
+	size_t capacity;
+	std::atomic<size_t> queued = 0;
+	Utils::EventCount notEmpty;
+	Utils::EventCount notFull;
+
+	std::atomic<bool> run = true;
+	std::vector<std::thread> threads;
+
+	// Our thread number, if this is one of our threads.
+	static thread_local size_t currentThreadNumber;
+	static constexpr size_t notOurs = SIZE_MAX;
+};
+}
+}
+
+#endif
@@ -28,16 +28,22 @@
 #define CAM_JOBS_JOB_HPP
 
 #include <vector>
+#include <array>
 #include <atomic>
 #include <cstdint>
-#include <functional>
 #include <new>
 
-#include "../Utils/CountedSharedMutex.hpp"
-#include "../Utils/ConditionalContinue.hpp"
+#include "../Utils/EventCount.hpp"
 #include "JobPool.hpp"
+#include "JobPriority.hpp"
 #include "../Utils/Aligner.tpp"
 #include "../Utils/Assert.hpp"
+#include "../Utils/InlineFunction.tpp"
+#include "../Utils/AppendOnlyList.tpp"
+#include "../Utils/Fiber.hpp"
+#include "../Utils/Epoch.hpp"
+#include "../Utils/SlabAllocator.tpp"
+#include "../Config.hpp"
 
 namespace CAM
 {
@@ -45,81 +51,162 @@ namespace Jobs
 {
 class WorkerPool;
 class Job;
+class JobCounter;
 
-struct JobD
+// Two cache lines. The first has everything the scheduler touches to queue,
+// pop, steal and complete us, the second what running us touches.
+struct alignas(64) JobD
 {
-	using JobFunc = std::function<void(WorkerPool* wp, size_t thread, Job* thisJob)>;
+	// Captures must fit in 48 bytes, and mustn't be over-aligned, which keeps
+	// a JobFunc to 56 bytes.
+	using JobFunc = Utils::InlineFunction<void(WorkerPool* wp, size_t thread, Job* thisJob), 48, alignof(void*)>;
 
 	std::atomic<JobPool*> owner;
-	mutable Utils::ConditionalContinue ownerCC;
-	mutable Utils::ConditionalContinue depsCC;
-	JobFunc job;
-	mutable std::atomic<size_t> dependencesIncomplete;
+	union
+	{
+		Job* nextInInbox; // While runnable
+		size_t unmetDepsSlot; // While parked
+	};
+	mutable std::atomic<uint32_t> dependencesIncomplete;
+	int16_t affinity;
+	bool mainThreadOnly : 1;
+	bool blocking : 1; // See BlockingWorkers
+	JobPriority priority;
+
+	// Most jobs have one to three dependents.
+	Utils::AppendOnlyList<Job, 3, 16> dependsOnMe;
+
+	alignas(64) JobFunc job;
+
+	// Unique to this use of the job, 0 once it has run. See JobHandle.
+	std::atomic<uint64_t> generation;
+};
+
+static_assert(sizeof(JobD) == 128, "JobD should be exactly two cache lines.");
+
+// A Job* which knows when the job is done. Jobs are recycled once done, so a
+// plain Job* kept around may end up pointing at some other job. A handle's
+// Get returns nullptr instead.
+//
+// Done jobs are only recycled once everyone in the epoch has moved on, see
+// Utils::Epoch. Jobs run outside of it, as they may wait or be suspended for
+// as long as they like, so what Get returns is only valid while you hold a
+// Utils::Epoch::Guard, which you mustn't wait while holding. Check and use it
+// in one go, like DependsOn(const JobHandle&) does.
+class JobHandle
+{
+	public:
+	JobHandle() = default;
+	inline explicit JobHandle(Job* job);
 
-	mutable CAM::Utils::CountedSharedMutex dependsOnMeMutex;
-	std::vector<Job*> dependsOnMe;
+	[[nodiscard]] inline Job* Get() const;
+	[[nodiscard]] inline bool Done() const { return Get() == nullptr; }
 
-	bool mainThreadOnly;
+	private:
+	Job* job = nullptr;
+	uint64_t generation = 0;
 };
 
 class Job : private Utils::Aligner<JobD>
 {
+	friend class JobPool;
+	friend class JobCounter;
+	friend class JobHandle;
+
 	public:
-	inline Job(JobFunc job, size_t depsOnMe, bool mainThreadOnly) { Reset(job, depsOnMe, mainThreadOnly); }
+	// The depot holds the whole reserve, so freed jobs only spill into its
+	// locked overflow once we've grown past it.
+	using Slab = Utils::SlabAllocator
+	<
+		Job,
+		Config::JobMagazineSize,
+		Config::JobSlabReserve / Config::JobMagazineSize
+	>;
+
+	// Jobs are made and freed on different threads all the time, so they
+	// come from a slab instead of the heap.
+	[[nodiscard]] static inline void* operator new(size_t size)
+	{
+		ASSERT(size == sizeof(Job), "Jobs can't be derived from.");
+		return Slab::Get().Allocate();
+	}
+	[[nodiscard]] static inline void* operator new(size_t size, std::align_val_t)
+	{
+		return operator new(size);
+	}
+	static inline void operator delete(void* p) { Slab::Get().Free(p); }
+	static inline void operator delete(void* p, std::align_val_t) { Slab::Get().Free(p); }
+
+	// affinity is the index of the worker which should run us, say because
+	// it has our data in its caches. -1 lets the WorkerPool decide.
+	inline Job
+	(
+		JobFunc job,
+		size_t depsOnMe,
+		bool mainThreadOnly,
+		JobPriority priority = JobPriority::Normal,
+		int affinity = -1
+	)
+	{
+		Reset(std::move(job), depsOnMe, mainThreadOnly, priority, affinity);
+	}
 	inline Job() { }
-	inline void Reset(JobFunc job, size_t depsOnMe, bool mainThreadOnly)
+
+	// So handles to jobs which were never run, or were freed some other way,
+	// go stale too.
+	inline ~Job()
 	{
-		ownerCC.Signal();
-		depsCC.Signal();
-		while(dependsOnMeMutex.LockersLeft() != 0) {}
-		while(dependsOnMeMutex.SharedLockersLeft() != 0) {}
-		ownerCC.Reset();
-		depsCC.Reset();
+		generation.store(0, std::memory_order_release);
+	}
 
-		this->job = job;
+	inline void Reset
+	(
+		JobFunc job,
+		size_t depsOnMe,
+		bool mainThreadOnly,
+		JobPriority priority = JobPriority::Normal,
+		int affinity = -1
+	)
+	{
+		this->job = std::move(job);
 
-		std::unique_lock<CAM::Utils::CountedSharedMutex> lock(dependsOnMeMutex);
-		dependsOnMe.clear();
-		dependsOnMe.reserve(depsOnMe);
+		dependsOnMe.Clear();
+		dependsOnMe.Reserve(depsOnMe);
 
 		this->mainThreadOnly = mainThreadOnly;
+		this->blocking = false;
+		this->priority = priority;
+		this->affinity = static_cast<int16_t>(affinity);
 
 		dependencesIncomplete.store(0, std::memory_order_relaxed);
-		owner.store(nullptr, std::memory_order_acq_rel);
+		generation.store(NextGeneration(), std::memory_order_relaxed);
+		owner.store(nullptr, std::memory_order_release);
 	}
 
+	[[nodiscard]] inline JobHandle Handle() { return JobHandle(this); }
+
 	[[nodiscard]] inline std::unique_ptr<Job> DoJob(WorkerPool* wp, size_t thread)
 	{
 		ASSERT(mainThreadOnly ? thread == 0 : true, "This is a main-thread-only job. Please insure only the main thread attempts to complete it.");
 
-		depsCC.Wait([this] { return CanRun(); } );
+		WaitOn(Event(), [this] { return CanRun(); } );
 
 		job(wp, thread, this);
 
+		// Nothing may depend on us from here on, so handles to us go stale
+		// before anything which depends on us gets to run.
+		generation.store(0, std::memory_order_release);
+
 		Job* toRun = nullptr;
-		auto deps = GetDepsOnMe();
-		for (auto& dep : deps.first)
+		dependsOnMe.ForEach([&toRun] (Job* dep)
 		{
-			// TODO: Make it so we go do other jobs then come back.
-			dep->ownerCC.Wait([&dep] { return dep->owner.load(std::memory_order_acquire) != nullptr; } );
-
-			size_t val = dep->dependencesIncomplete.load(std::memory_order_acquire);
-
-			while(!std::atomic_compare_exchange_weak_explicit
-			(
-				&dep->dependencesIncomplete,
-				&val,
-				val - 1,
-				std::memory_order_acq_rel,
-				std::memory_order_relaxed
-			)) {}
-
-			dep->depsCC.Signal();
-
-			if (val == 1) // I was last to subtract
+			if (dep->DependencyDone()) // I was last to subtract
 			{
 				if (toRun != nullptr)
 				{
+					// Someone might run it and be done with it before
+					// MakeRunnable returns.
+					Utils::Epoch::Guard epoch;
 					dep->owner.load(std::memory_order_acquire)->MakeRunnable(dep);
 				}
 				else
@@ -127,7 +214,7 @@ class Job : private Utils::Aligner<JobD>
 					toRun = dep;
 				}
 			}
-		}
+		});
 
 		if (toRun != nullptr)
 		{
@@ -143,11 +230,19 @@ class Job : private Utils::Aligner<JobD>
 		return dependencesIncomplete.load(std::memory_order_acquire) == 0;
 	}
 
-	// TODO: Make events a type of dependency
 	inline void DependsOn(Job* other)
 	{
 		other->DependsOnMe(this);
 	}
+	inline void DependsOn(const JobHandle& other)
+	{
+		Utils::Epoch::Guard epoch;
+		Job* job = other.Get();
+		ASSERT(job != nullptr, "Jobs must depend on a job before it is done.");
+		DependsOn(job);
+	}
+	// Defined in JobCounter.hpp
+	inline void DependsOn(JobCounter* counter);
 	inline void DependsOnMe(Job* other)
 	{
 		if (other == nullptr)
@@ -155,48 +250,119 @@ class Job : private Utils::Aligner<JobD>
 			return;
 		}
 		other->dependencesIncomplete.fetch_add(1, std::memory_order_release);
-		depsCC.Signal();
-		std::unique_lock<CAM::Utils::CountedSharedMutex> lock(other->dependsOnMeMutex);
-		dependsOnMe.push_back(other);
+		Event().NotifyAll();
+		dependsOnMe.Append(other);
 	}
 
 	inline void SetOwner(JobPool* owner)
 	{
 		this->owner.store(owner, std::memory_order_release);
-		ownerCC.Signal();
+		Event().NotifyAll();
 	}
 
 	[[nodiscard]] inline size_t NumberOfDepsOnMe() const
 	{
-		std::shared_lock<CAM::Utils::CountedSharedMutex> lock(dependsOnMeMutex);
-		return dependsOnMe.size();
+		return dependsOnMe.Size();
 	}
 	inline bool MainThreadOnly() const { return mainThreadOnly; }
 
+	// Blocking jobs, say ones doing I/O, are run by the WorkerPool's
+	// BlockingWorkers, if it has any, and never by its Workers. Set before
+	// submitting.
+	inline bool Blocking() const { return blocking; }
+	inline void SetBlocking(bool blocking = true)
+	{
+		ASSERT(!(blocking && mainThreadOnly), "A job can't both block and be main thread only.");
+		this->blocking = blocking;
+	}
+	inline JobPriority Priority() const { return priority; }
+	inline int Affinity() const { return affinity; }
+
 	inline void SameThingsDependOnMeAs(Job* other)
 	{
-		auto otherDeps = other->GetDepsOnMe();
-		std::unique_lock<CAM::Utils::CountedSharedMutex> lock(dependsOnMeMutex);
+		other->dependsOnMe.ForEach([this] (Job* dep)
+		{
+			DependsOnMe(dep);
+		});
+	}
+
+	private:
+	// Called once one of our dependencies is done. Returns true if it was the
+	// last one, in which case the caller must get us run.
+	[[nodiscard]] inline bool DependencyDone()
+	{
+		WaitOn(Event(), [this] { return owner.load(std::memory_order_acquire) != nullptr; } );
+
+		uint32_t val = dependencesIncomplete.load(std::memory_order_acquire);
 
-		dependsOnMe.reserve(dependsOnMe.size() + otherDeps.first.size());
+		while(!std::atomic_compare_exchange_weak_explicit
+		(
+			&dependencesIncomplete,
+			&val,
+			val - 1,
+			std::memory_order_acq_rel,
+			std::memory_order_relaxed
+		)) {}
+
+		Event().NotifyAll();
+
+		return val == 1;
+	}
+
+	// Waiting on a job is rare, so rather than each carrying its own events,
+	// jobs share a few. Waiters recheck what they wait for, so sharing only
+	// costs the odd spurious wakeup.
+	struct alignas(64) EventStripe
+	{
+		Utils::EventCount event;
+	};
+	static constexpr size_t eventStripeCount = 64;
+	static inline std::array<EventStripe, eventStripeCount> eventStripes;
+
+	[[nodiscard]] inline Utils::EventCount& Event() const
+	{
+		return eventStripes[(reinterpret_cast<uintptr_t>(this) / sizeof(JobD)) % eventStripeCount].event;
+	}
 
-		for (auto& dep : otherDeps.first)
+	// Handed out in blocks, so threads don't fight over one counter.
+	[[nodiscard]] static inline uint64_t NextGeneration()
+	{
+		static constexpr uint64_t blockSize = 1024;
+		static std::atomic<uint64_t> nextBlock = 1;
+		static thread_local uint64_t next = 0;
+		static thread_local uint64_t end = 0;
+		if (next == end)
 		{
-			DependsOnMe(dep);
+			next = nextBlock.fetch_add(blockSize, std::memory_order_relaxed);
+			end = next + blockSize;
 		}
+		return next++;
 	}
 
-	private:
-	[[nodiscard]] inline std::pair
-	<
-		const std::vector<Job*>&,
-		std::shared_lock<CAM::Utils::CountedSharedMutex>
-	> GetDepsOnMe() const
+	// Suspends our fiber if we are on one, else blocks the thread.
+	template<class Pred>
+	static inline void WaitOn(Utils::EventCount& event, Pred pred)
 	{
-		return {dependsOnMe, std::shared_lock<CAM::Utils::CountedSharedMutex>(dependsOnMeMutex)};
+		ASSERT(!Utils::Epoch::Active(), "Can't wait while in the epoch, it'd hold up reclaiming jobs.");
+		if (!Utils::Fiber::YieldUntil(pred, event))
+		{
+			event.Wait(pred);
+		}
 	}
 };
 }
 }
 
+inline CAM::Jobs::JobHandle::JobHandle(Job* job)
+	: job(job), generation(job->generation.load(std::memory_order_acquire)) {}
+
+inline CAM::Jobs::Job* CAM::Jobs::JobHandle::Get() const
+{
+	if (job == nullptr || generation == 0 || job->generation.load(std::memory_order_acquire) != generation)
+	{
+		return nullptr;
+	}
+	return job;
+}
+
 #endif
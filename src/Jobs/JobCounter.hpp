@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A dependency which isn't a job. Jobs can DependsOn a JobCounter, they won't
+ * run till the counter drops to zero. So if M jobs wait on N jobs, the N jobs
+ * can each Decrement one counter instead of the M jobs having N*M edges.
+ *
+ * A JobEvent is a counter of one, for things outside of the job system like
+ * fences and I/O. Signal it from any thread.
+ *
+ * Like with jobs, everything which depends on a counter must do so before it
+ * can reach zero. Reset it before reusing it.
+ */
+
+#ifndef CAM_JOBS_JOBCOUNTER_HPP
+#define CAM_JOBS_JOBCOUNTER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "Job.hpp"
+#include "../Utils/AppendOnlyList.tpp"
+#include "../Utils/Assert.hpp"
+#include "../Utils/Epoch.hpp"
+
+namespace CAM
+{
+namespace Jobs
+{
+class JobCounter
+{
+	public:
+	inline explicit JobCounter(size_t count) : count(count) {}
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter(JobCounter&&) = delete;
+	JobCounter& operator=(const JobCounter&)& = delete;
+	JobCounter& operator=(JobCounter&&)& = delete;
+
+	inline void Add(size_t n = 1)
+	{
+		count.fetch_add(n, std::memory_order_acq_rel);
+	}
+
+	// The last decrement lets everything depending on us run. We go through
+	// our dependents after they've been made runnable, so we must outlive
+	// that. Don't free us from a dependent, it may run before we're done.
+	inline void Decrement()
+	{
+		size_t val = count.fetch_sub(1, std::memory_order_acq_rel);
+		ASSERT(val != 0, "JobCounter was decremented past zero.");
+
+		if (val == 1)
+		{
+			Release();
+		}
+	}
+
+	[[nodiscard]] inline bool Done() const
+	{
+		return count.load(std::memory_order_acquire) == 0;
+	}
+
+	// Nothing may be depending on us or decrementing us.
+	inline void Reset(size_t count)
+	{
+		dependsOnMe.Clear();
+		this->count.store(count, std::memory_order_release);
+	}
+
+	inline void DependsOnMe(Job* job)
+	{
+		ASSERT(!Done(), "Jobs must depend on a JobCounter before it reaches zero.");
+		job->dependencesIncomplete.fetch_add(1, std::memory_order_release);
+		job->Event().NotifyAll();
+		dependsOnMe.Append(job);
+	}
+
+	private:
+	inline void Release()
+	{
+		// MakeRunnable wakes someone up to run them, in case we were signaled
+		// from outside the job system. Then they might run and be done with
+		// before we are done with them. DependencyDone may wait, so the guard
+		// is only held around the bit which needs it.
+		dependsOnMe.ForEach([] (Job* dep)
+		{
+			if (dep->DependencyDone())
+			{
+				Utils::Epoch::Guard epoch;
+				dep->owner.load(std::memory_order_acquire)->MakeRunnable(dep);
+			}
+		});
+	}
+
+	std::atomic<size_t> count;
+	Utils::AppendOnlyList<Job, 4, 16> dependsOnMe;
+};
+
+class JobEvent : public JobCounter
+{
+	public:
+	inline JobEvent() : JobCounter(1) {}
+
+	// Like Decrement, we must outlive this call, even though what depends
+	// on us may already be running.
+	inline void Signal() { Decrement(); }
+	[[nodiscard]] inline bool Signaled() const { return Done(); }
+	inline void Reset() { JobCounter::Reset(1); }
+};
+}
+}
+
+inline void CAM::Jobs::Job::DependsOn(JobCounter* counter)
+{
+	counter->DependsOnMe(this);
+}
+
+#endif
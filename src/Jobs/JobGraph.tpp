@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A job graph which is recorded once and then run as often as you like, say
+ * once per frame:
+ *
+ *	JobGraph<FrameParams> graph;
+ *	auto a = graph.AddNode([] (WorkerPool*, size_t, Job*, const FrameParams& p) { ... });
+ *	auto b = graph.AddNode(...);
+ *	graph.AddEdge(a, b); // b runs after a
+ *
+ *	graph.Instantiate(wp, FrameParams{frame}, thisJob);
+ *
+ * Instantiating doesn't touch the graph. Each run gets a copy of the params
+ * and its own dependency counters, preset from the graph, and a node's job is
+ * only made once the node's counter hits zero. So no job ever waits parked,
+ * and no DependsOn edges are made between nodes.
+ *
+ * Nodes which extend themselves by making things depend on thisJob (with
+ * SameThingsDependOnMeAs) must be added as extensible. They get a second job
+ * which completes them, the rest complete as soon as they return.
+ *
+ * Runs are recycled once finished. Don't add nodes or edges after the first
+ * Instantiate, and don't Instantiate from two threads at once.
+ *
+ * What a run allocates as it goes, like the lists of jobs it is about to
+ * submit, comes from the scratch resource passed to Instantiate. Pass a
+ * FrameArena's Resource() for graphs run once per frame.
+ */
+
+#ifndef CAM_JOBS_JOBGRAPH_TPP
+#define CAM_JOBS_JOBGRAPH_TPP
+
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+#include "Job.hpp"
+#include "JobCounter.hpp"
+#include "WorkerPool.hpp"
+#include "../Utils/InlineFunction.tpp"
+#include "../Utils/Assert.hpp"
+
+namespace CAM
+{
+namespace Jobs
+{
+template<typename Params>
+class JobGraph
+{
+	public:
+	using NodeFunc = Utils::InlineFunction<void(WorkerPool* wp, size_t thread, Job* thisJob, const Params& params), 48>;
+	using NodeId = size_t;
+
+	JobGraph() = default;
+
+	JobGraph(const JobGraph&) = delete;
+	JobGraph(JobGraph&&) = delete;
+	JobGraph& operator=(const JobGraph&)& = delete;
+	JobGraph& operator=(JobGraph&&)& = delete;
+
+	// Every run must have finished before we die.
+	~JobGraph() = default;
+
+	inline NodeId AddNode
+	(
+		NodeFunc func,
+		bool mainThreadOnly = false,
+		JobPriority priority = JobPriority::Normal,
+		bool extensible = false
+	)
+	{
+		ASSERT(runs.empty(), "Can't change a JobGraph after it's been instantiated.");
+		nodes.push_back(Node{std::move(func), mainThreadOnly, priority, extensible, 0, {}});
+		return nodes.size() - 1;
+	}
+
+	// to runs after from.
+	inline void AddEdge(NodeId from, NodeId to)
+	{
+		ASSERT(runs.empty(), "Can't change a JobGraph after it's been instantiated.");
+		ASSERT(from < nodes.size() && to < nodes.size(), "No such node.");
+		nodes[from].successors.push_back(to);
+		++nodes[to].incoming;
+	}
+
+	// If thisJob is passed, the things which depend on it will also depend
+	// on this run finishing. scratch must outlive the run.
+	void Instantiate
+	(
+		WorkerPool* wp,
+		Params params,
+		Job* thisJob = nullptr,
+		std::pmr::memory_resource* scratch = std::pmr::get_default_resource()
+	)
+	{
+		ASSERT(!nodes.empty(), "Can't instantiate an empty JobGraph.");
+
+		Run* run = GetRun();
+		run->params = std::move(params);
+		run->scratch = scratch;
+		for (size_t i = 0; i < nodes.size(); ++i)
+		{
+			run->pending[i].store(nodes[i].incoming, std::memory_order_relaxed);
+		}
+		run->nodesLeft.store(nodes.size(), std::memory_order_relaxed);
+		run->done.Reset();
+
+		// Only here to hand thisJob's dependents over to.
+		auto finish = wp->GetJob([] (WorkerPool*, size_t, Job*) {}, 0, false);
+		finish->DependsOn(&run->done);
+		if (thisJob != nullptr)
+		{
+			finish->SameThingsDependOnMeAs(thisJob);
+		}
+		if (!wp->SubmitJob(std::move(finish))) { throw std::runtime_error("Could not submit job\n"); }
+
+		ReadyJobs ready(scratch);
+		for (size_t i = 0; i < nodes.size(); ++i)
+		{
+			if (nodes[i].incoming == 0)
+			{
+				MakeNodeJobs(wp, run, i, ready);
+			}
+		}
+		SubmitReady(wp, ready);
+	}
+
+	private:
+	using ReadyJobs = std::pmr::vector<std::unique_ptr<Job>>;
+
+	struct Node
+	{
+		NodeFunc func;
+		bool mainThreadOnly;
+		JobPriority priority;
+		bool extensible;
+		size_t incoming;
+		std::vector<NodeId> successors;
+	};
+
+	struct Run
+	{
+		inline explicit Run(size_t nodes) : pending(new std::atomic<size_t>[nodes]) {}
+
+		Params params;
+		std::pmr::memory_resource* scratch;
+		std::unique_ptr<std::atomic<size_t>[]> pending;
+		std::atomic<size_t> nodesLeft = 0;
+		JobEvent done;
+		std::atomic<bool> inUse = false;
+	};
+
+	inline Run* GetRun()
+	{
+		for (auto& run : runs)
+		{
+			bool expected = false;
+			if (run->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				return run.get();
+			}
+		}
+
+		runs.push_back(std::make_unique<Run>(nodes.size()));
+		runs.back()->inUse.store(true, std::memory_order_relaxed);
+		return runs.back().get();
+	}
+
+	// Appends node's jobs to ready.
+	inline void MakeNodeJobs(WorkerPool* wp, Run* run, NodeId node, ReadyJobs& ready)
+	{
+		auto& n = nodes[node];
+		auto job = wp->GetJob
+		(
+			[this, run, node] (WorkerPool* wp, size_t thread, Job* thisJob)
+			{
+				auto& n = nodes[node];
+				n.func(wp, thread, thisJob, run->params);
+				if (!n.extensible)
+				{
+					CompleteNode(wp, run, node);
+				}
+			},
+			0,
+			n.mainThreadOnly,
+			n.priority
+		);
+
+		if (n.extensible)
+		{
+			auto complete = wp->GetJob
+			(
+				[this, run, node] (WorkerPool* wp, size_t, Job*)
+				{
+					CompleteNode(wp, run, node);
+				},
+				0,
+				false,
+				n.priority
+			);
+			complete->DependsOn(job->Handle());
+			ready.push_back(std::move(complete));
+		}
+
+		ready.push_back(std::move(job));
+	}
+
+	inline void CompleteNode(WorkerPool* wp, Run* run, NodeId node)
+	{
+		// Our own, as submitting may suspend us and let another fiber on this
+		// thread complete a node meanwhile.
+		ReadyJobs ready(run->scratch);
+		for (auto successor : nodes[node].successors)
+		{
+			if (run->pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				MakeNodeJobs(wp, run, successor, ready);
+			}
+		}
+		SubmitReady(wp, ready);
+
+		// Only free the run once done has finished releasing, so it's never
+		// Reset under it.
+		if (run->nodesLeft.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			run->done.Signal();
+			run->inUse.store(false, std::memory_order_release);
+		}
+	}
+
+	static inline void SubmitReady(WorkerPool* wp, ReadyJobs& ready)
+	{
+		if (ready.empty())
+		{
+			return;
+		}
+
+		if (!wp->SubmitJobs(ready.data(), ready.size())) { throw std::runtime_error("Could not submit job\n"); }
+		ready.clear();
+	}
+
+	std::vector<Node> nodes;
+	std::vector<std::unique_ptr<Run>> runs;
+};
+}
+}
+
+#endif
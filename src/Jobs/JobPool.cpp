@@ -21,116 +21,394 @@
 #include "Job.hpp"
 #include "WorkerPool.hpp"
 #include "../Utils/Assert.hpp"
+#include "../Config.hpp"
 
 CAM::Jobs::JobPool::JobPool(WorkerPool* wp) : wp(wp)
 {}
 
+CAM::Jobs::JobPool::~JobPool()
+{
+	for (auto& lane : lanes)
+	{
+		Job* job;
+		while ((job = lane.jobs.Pop()) != nullptr)
+		{
+			delete job;
+		}
+
+		job = TakeInbox(lane);
+		while (job != nullptr)
+		{
+			auto next = job->nextInInbox;
+			delete job;
+			job = next;
+		}
+	}
+}
+
+void CAM::Jobs::JobPool::BindToThisThread()
+{
+	ownerThread.store(std::this_thread::get_id(), std::memory_order_release);
+}
+
 void CAM::Jobs::JobPool::SubmitJob(std::unique_ptr<Job> job)
+{
+	wp->JobsSubmitted(1);
+	Enqueue(std::move(job));
+}
+
+void CAM::Jobs::JobPool::Enqueue(std::unique_ptr<Job> job)
 {
 	if (job->CanRun())
 	{
-		std::unique_lock<std::shared_mutex> lock(jobsMutex);
+		if (job->Blocking() && wp->QueueBlockingJob(job))
+		{
+			return;
+		}
+
+		bool mainThreadPool = this == &wp->MainThreadJobs();
 
-		if (!jobs.empty())
+		if (job->Priority() == JobPriority::FrameCritical && !mainThreadPool)
 		{
-			wp->WakeUpThreads(1);
+			wp->FrameCriticalJobQueued();
 		}
+		PushRunnable(job.release());
 
-		jobs.push_back(std::move(job));
-		jobs.back()->SetOwner(this);
+		// The main thread never sleeps, and nobody else can take its jobs.
+		if (!mainThreadPool)
+		{
+			wp->WakeUpThreads(1, workerIndex);
+		}
 	}
 	else
 	{
-		std::unique_lock<std::shared_mutex> lock(jobsWithUnmetDepsMutex);
-		jobsWithUnmetDeps.push_back(std::move(job));
-		jobsWithUnmetDeps.back()->SetOwner(this);
+		std::unique_lock<std::mutex> lock(jobsWithUnmetDepsMutex);
+		Park(std::move(job));
 	}
 }
 
+size_t CAM::Jobs::JobPool::SubmitJobs(std::unique_ptr<Job>* batch, size_t count)
+{
+	bool mainThreadPool = this == &wp->MainThreadJobs();
+	bool owner = IsOwner();
+	wp->JobsSubmitted(count);
+
+	std::array<Job*, JobPriorityCount> heads = {};
+	std::array<Job*, JobPriorityCount> tails = {};
+	std::array<size_t, JobPriorityCount> sizes = {};
+
+	std::unique_lock<std::mutex> lock(jobsWithUnmetDepsMutex, std::defer_lock);
+	size_t runnable = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto& job = batch[i];
+		if (!job->CanRun())
+		{
+			if (!lock) { lock.lock(); }
+			Park(std::move(job));
+			continue;
+		}
+
+		// WorkerPool took the ones runnable then, but that may have changed.
+		if (job->Blocking() && wp->QueueBlockingJob(job))
+		{
+			continue;
+		}
+
+		++runnable;
+		if (job->Priority() == JobPriority::FrameCritical && !mainThreadPool)
+		{
+			wp->FrameCriticalJobQueued();
+		}
+
+		Job* j = job.release();
+		j->SetOwner(this);
+		size_t lane = static_cast<size_t>(j->Priority());
+		if (owner)
+		{
+			lanes[lane].jobs.Push(j);
+			continue;
+		}
+
+		// Chained up so each inbox takes one CAS
+		j->nextInInbox = heads[lane];
+		heads[lane] = j;
+		if (tails[lane] == nullptr) { tails[lane] = j; }
+		++sizes[lane];
+	}
+
+	for (size_t lane = 0; lane < JobPriorityCount; ++lane)
+	{
+		if (heads[lane] != nullptr)
+		{
+			PushInbox(lanes[lane], heads[lane], tails[lane], sizes[lane]);
+		}
+	}
+
+	return runnable;
+}
+
+void CAM::Jobs::JobPool::Park(std::unique_ptr<Job> job)
+{
+	size_t slot;
+	if (freeUnmetDepsSlots.empty())
+	{
+		slot = jobsWithUnmetDeps.size();
+		jobsWithUnmetDeps.push_back(nullptr);
+	}
+	else
+	{
+		slot = freeUnmetDepsSlots.back();
+		freeUnmetDepsSlots.pop_back();
+	}
+
+	job->unmetDepsSlot = slot;
+	jobsWithUnmetDeps[slot] = std::move(job);
+	jobsWithUnmetDepsCount.fetch_add(1, std::memory_order_relaxed);
+	jobsWithUnmetDeps[slot]->SetOwner(this);
+}
+
 std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::JobPool::PullJob()
 {
-	std::unique_lock<std::shared_mutex> lock(jobsMutex);
-	if (jobs.empty())
+	ASSERT(IsOwner(), "Only the thread which owns a JobPool may pull from it, everyone else must steal.");
+
+	Job* ret = nullptr;
+	size_t picked = PickLane();
+	if (picked != JobPriorityCount)
+	{
+		ret = PullFromLane(lanes[picked]);
+	}
+
+	// A thief may've beaten us to the lane we picked.
+	for (size_t i = 0; ret == nullptr && i < JobPriorityCount; ++i)
+	{
+		ret = PullFromLane(lanes[i]);
+	}
+
+	if (ret == nullptr)
+	{
+		return nullptr;
+	}
+
+	CountOut(ret);
+	ret->SetOwner(nullptr);
+	return std::unique_ptr<Job>(ret);
+}
+
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::JobPool::StealJob(JobPool& into, JobPriority atLeast)
+{
+	Job* ret = nullptr;
+	for (size_t i = 0; ret == nullptr && i <= static_cast<size_t>(atLeast); ++i)
+	{
+		auto& lane = lanes[i];
+		ret = lane.jobs.Steal();
+		if (ret != nullptr)
+		{
+			break;
+		}
+
+		ret = TakeInbox(lane);
+		if (ret == nullptr)
+		{
+			continue;
+		}
+
+		Job* job = ret->nextInInbox;
+		if (job != nullptr)
+		{
+			while (job != nullptr)
+			{
+				auto next = job->nextInInbox;
+				into.PushRunnable(job);
+				job = next;
+			}
+
+			wp->WakeUpThreads(1);
+		}
+	}
+
+	if (ret == nullptr)
+	{
+		return nullptr;
+	}
+
+	CountOut(ret);
+	ret->SetOwner(nullptr);
+	return std::unique_ptr<Job>(ret);
+}
+
+void CAM::Jobs::JobPool::PushRunnable(Job* job)
+{
+	job->SetOwner(this);
+
+	auto& lane = lanes[static_cast<size_t>(job->Priority())];
+	if (IsOwner())
+	{
+		lane.jobs.Push(job);
+	}
+	else
+	{
+		PushInbox(lane, job);
+	}
+}
+
+void CAM::Jobs::JobPool::PushInbox(Lane& lane, Job* job)
+{
+	PushInbox(lane, job, job, 1);
+}
+
+void CAM::Jobs::JobPool::PushInbox(Lane& lane, Job* first, Job* last, size_t count)
+{
+	lane.inboxSize.fetch_add(count, std::memory_order_relaxed);
+
+	Job* head = lane.inbox.load(std::memory_order_relaxed);
+	do
+	{
+		last->nextInInbox = head;
+	} while (!lane.inbox.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+}
+
+CAM::Jobs::Job* CAM::Jobs::JobPool::TakeInbox(Lane& lane)
+{
+	if (lane.inbox.load(std::memory_order_relaxed) == nullptr)
 	{
 		return nullptr;
 	}
 
-	jobs.back()->SetOwner(nullptr);
-	auto ret = std::move(jobs.back());
-	jobs.pop_back();
+	Job* ret = lane.inbox.exchange(nullptr, std::memory_order_acquire);
+
+	size_t taken = 0;
+	for (Job* job = ret; job != nullptr; job = job->nextInInbox)
+	{
+		++taken;
+	}
+	lane.inboxSize.fetch_sub(taken, std::memory_order_relaxed);
+
 	return ret;
 }
 
-bool CAM::Jobs::JobPool::Empty() const
+CAM::Jobs::Job* CAM::Jobs::JobPool::PullFromLane(Lane& lane)
 {
-	std::shared_lock<std::shared_mutex> lock1(jobsMutex, std::defer_lock);
-	std::shared_lock<std::shared_mutex> lock2(jobsWithUnmetDepsMutex, std::defer_lock);
-	std::lock(lock1, lock2);
+	Job* ret = lane.jobs.Pop();
+	if (ret != nullptr)
+	{
+		return ret;
+	}
+
+	ret = TakeInbox(lane);
+	if (ret == nullptr)
+	{
+		return nullptr;
+	}
+
+	Job* job = ret->nextInInbox;
+	while (job != nullptr)
+	{
+		auto next = job->nextInInbox;
+		lane.jobs.Push(job);
+		job = next;
+	}
 
-	return jobs.empty() && jobsWithUnmetDeps.empty();
+	return ret;
+}
+
+size_t CAM::Jobs::JobPool::PickLane()
+{
+	size_t picked = JobPriorityCount;
+	for (size_t i = 0; i < JobPriorityCount; ++i)
+	{
+		auto& lane = lanes[i];
+		if (lane.NoRunnableJobs())
+		{
+			lane.age = 0;
+			continue;
+		}
+
+		if (picked == JobPriorityCount || lane.age >= Config::JobAgingLimit)
+		{
+			picked = i;
+		}
+	}
+
+	for (size_t i = 0; i < JobPriorityCount; ++i)
+	{
+		if (i == picked)
+		{
+			lanes[i].age = 0;
+		}
+		else if (i > picked && !lanes[i].NoRunnableJobs())
+		{
+			++lanes[i].age;
+		}
+	}
+
+	return picked;
+}
+
+void CAM::Jobs::JobPool::CountOut(Job* job)
+{
+	if (job->Priority() == JobPriority::FrameCritical && this != &wp->MainThreadJobs())
+	{
+		wp->FrameCriticalJobTaken();
+	}
+}
+
+bool CAM::Jobs::JobPool::Empty() const
+{
+	return NoRunnableJobs() && jobsWithUnmetDepsCount.load(std::memory_order_acquire) == 0;
 }
 
 bool CAM::Jobs::JobPool::NoRunnableJobs() const
 {
-	std::shared_lock<std::shared_mutex> lock(jobsMutex);
-	return jobs.empty();
+	for (auto& lane : lanes)
+	{
+		if (!lane.NoRunnableJobs())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CAM::Jobs::JobPool::HasRunnableJobs(JobPriority priority) const
+{
+	return !lanes[static_cast<size_t>(priority)].NoRunnableJobs();
 }
 
 size_t CAM::Jobs::JobPool::RunnableJobsLeft() const
 {
-	std::shared_lock<std::shared_mutex> lock(jobsMutex);
-	return jobs.size();
+	size_t ret = 0;
+	for (auto& lane : lanes)
+	{
+		ret += lane.jobs.Size() + lane.inboxSize.load(std::memory_order_relaxed);
+	}
+	return ret;
 }
 
 void CAM::Jobs::JobPool::MakeRunnable(Job* job)
 {
 	ASSERT(job->CanRun(), "We should only be making runnable jobs runnable.");
-	SubmitJob(PullDepJob(job));
+	Enqueue(PullDepJob(job)); // Already counted when first submitted
 }
 
 std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::JobPool::PullDepJob(Job* job)
 {
 	ASSERT(job->CanRun(), "We should only be pulling runnable jobs out of the jobsWithUnmetDeps vector.");
-	std::shared_lock<std::shared_mutex> lock(jobsWithUnmetDepsMutex);
+	std::unique_lock<std::mutex> lock(jobsWithUnmetDepsMutex);
 
 	job->SetOwner(nullptr);
 
-	auto e = std::find_if
-	(
-		std::begin(jobsWithUnmetDeps),
-		std::end(jobsWithUnmetDeps),
-		[&job] (const std::unique_ptr<Job>& a) -> bool
-		{
-			return a.get() == job;
-		}
-	);
-
+	size_t slot = job->unmetDepsSlot;
 	ASSERT
 	(
-		e != std::end(jobsWithUnmetDeps),
+		slot < jobsWithUnmetDeps.size() && jobsWithUnmetDeps[slot].get() == job,
 		"We should only be pulling jobs out of the jobsWithUnmetDeps vector if they are in it. Likely a sync error with the owner variable."
 		" " + std::to_string((size_t)job)
 	);
 
-	std::unique_ptr<Jobs::Job> ret = nullptr;
-	std::swap(*e, ret);
-
-	ASSERT(ret != nullptr, "The job we pulled shouldn't be a nullptr");
-
-
-	if (!jobsWithUnmetDeps.empty() && jobsWithUnmetDeps.back() == nullptr)
-	{
-		lock.unlock();
-		std::unique_lock<std::shared_mutex> lock2(jobsWithUnmetDepsMutex);
-		while (!jobsWithUnmetDeps.empty() && jobsWithUnmetDeps.back() == nullptr)
-		{
-			jobsWithUnmetDeps.pop_back();
-		}
-	}
-	else
-	{
-		lock.unlock();
-	}
+	std::unique_ptr<Jobs::Job> ret = std::move(jobsWithUnmetDeps[slot]);
+	freeUnmetDepsSlots.push_back(slot);
+	jobsWithUnmetDepsCount.fetch_sub(1, std::memory_order_relaxed);
 
 	return ret;
 }
@@ -21,6 +21,17 @@
  * This is a (hopefully) thread-safe class which stores jobs. (LIFO)
  *
  * Each worker owns its own pool, which it draws jobs from until empty.
+ *
+ * Runnable jobs live in a lock-free work-stealing deque. Only the thread bound
+ * with BindToThisThread may push onto it or pull from it, everyone else can
+ * only steal from it. Jobs submitted from other threads go into a lock-free
+ * inbox, which the owner drains into its deque when it runs dry. Thieves may
+ * take the whole inbox too, so jobs don't rot while the owner is busy.
+ *
+ * There is one deque and inbox, a lane, per JobPriority. Higher lanes are
+ * always pulled and stolen from first. So a lower lane can't starve, every
+ * time it is passed over while it has jobs it ages by one. Once it has aged
+ * Config::JobAgingLimit times, the owner takes a job from it instead.
  */
 
 #ifndef CAM_JOBS_JOBPOOL_HPP
@@ -28,12 +39,16 @@
 
 #include <vector>
 #include <mutex>
-#include <shared_mutex>
 #include <thread>
 #include <algorithm>
 #include <cstdint>
+#include <atomic>
+#include <memory>
+#include <array>
 
 #include "../Utils/Aligner.tpp"
+#include "../Utils/WorkStealingDeque.tpp"
+#include "JobPriority.hpp"
 
 namespace CAM
 {
@@ -42,18 +57,46 @@ namespace Jobs
 class Job;
 class WorkerPool;
 
-// TODO: If its too slow, try to use atomics instead
-// https://manu343726.github.io/2017/03/13/lock-free-job-stealing-task-system-with-modern-c.html
 class JobPool
 {
 	public:
 	JobPool(WorkerPool* wp);
+	~JobPool();
+
+	JobPool(const JobPool&) = delete;
+	JobPool(JobPool&&) = delete;
+	JobPool& operator=(const JobPool&)& = delete;
+	JobPool& operator=(JobPool&&)& = delete;
 
+	// Must be called by the thread which will be pulling from this pool
+	// before it pulls anything.
+	void BindToThisThread();
+	[[nodiscard]] inline bool IsOwner() const
+	{
+		return ownerThread.load(std::memory_order_acquire) == std::this_thread::get_id();
+	}
+
+	// Submitting a runnable job wakes up a sleeping worker to take it,
+	// preferably the one owning this pool. Submitted jobs count towards the
+	// WorkerPool's outstanding jobs till they are done.
 	void SubmitJob(std::unique_ptr<Job> job);
-	std::unique_ptr<Job> PullJob();
+	inline void SetWorkerIndex(int index) { workerIndex = index; }
+
+	// Submits count jobs, taking our locks at most once, and returns how
+	// many of them were runnable. Wakes nobody, that's up to the caller.
+	size_t SubmitJobs(std::unique_ptr<Job>* batch, size_t count);
+
+	// Owner only
+	[[nodiscard]] std::unique_ptr<Job> PullJob();
+
+	// Any thread. Should we steal a whole inbox, the leftovers are submitted
+	// to into, which must be owned by the calling thread. Only jobs of
+	// atLeast's priority or higher are stolen.
+	[[nodiscard]] std::unique_ptr<Job> StealJob(JobPool& into, JobPriority atLeast = JobPriority::Background);
 
 	[[nodiscard]] bool Empty() const;
 	[[nodiscard]] bool NoRunnableJobs() const;
+	[[nodiscard]] bool HasRunnableJobs(JobPriority priority) const;
 
 	[[nodiscard]] size_t RunnableJobsLeft() const;
 
@@ -62,11 +105,42 @@ class JobPool
 	[[nodiscard]] std::unique_ptr<Job> PullDepJob(Job* job);
 
 	private:
-	mutable std::shared_mutex jobsMutex;
-	mutable std::shared_mutex jobsWithUnmetDepsMutex;
-	std::vector<std::unique_ptr<Job>> jobs;
+	struct Lane
+	{
+		Utils::WorkStealingDeque<Job> jobs;
+		alignas(64) std::atomic<Job*> inbox = nullptr;
+		std::atomic<size_t> inboxSize = 0;
+
+		// Owner only
+		size_t age = 0;
+
+		[[nodiscard]] inline bool NoRunnableJobs() const
+		{
+			return jobs.Empty() && inbox.load(std::memory_order_acquire) == nullptr;
+		}
+	};
+
+	void Enqueue(std::unique_ptr<Job> job); // SubmitJob without counting it
+	void PushRunnable(Job* job);
+	void PushInbox(Lane& lane, Job* job);
+	void PushInbox(Lane& lane, Job* first, Job* last, size_t count); // first to last linked by nextInInbox
+	void Park(std::unique_ptr<Job> job); // jobsWithUnmetDepsMutex must be held
+	[[nodiscard]] static Job* TakeInbox(Lane& lane);
+	[[nodiscard]] Job* PullFromLane(Lane& lane);
+	[[nodiscard]] size_t PickLane();
+	void CountOut(Job* job);
+
+	std::array<Lane, JobPriorityCount> lanes;
+	std::atomic<std::thread::id> ownerThread = std::thread::id();
+
+	// Each parked job remembers its slot, so pulling it out is O(1). Slots
+	// are recycled though freeUnmetDepsSlots instead of compacting.
+	std::mutex jobsWithUnmetDepsMutex;
 	std::vector<std::unique_ptr<Job>> jobsWithUnmetDeps;
+	std::vector<size_t> freeUnmetDepsSlots;
+	std::atomic<size_t> jobsWithUnmetDepsCount = 0;
 	WorkerPool* wp;
+	int workerIndex = -1;
 };
 }
 }
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The priority classes a job can be in, highest first.
+ *
+ * FrameCritical is for the jobs which the next frame is waiting on, like
+ * acquiring and presenting images. Background is for things like streaming,
+ * which may take a few frames.
+ */
+
+#ifndef CAM_JOBS_JOBPRIORITY_HPP
+#define CAM_JOBS_JOBPRIORITY_HPP
+
+#include <cstdint>
+
+namespace CAM
+{
+namespace Jobs
+{
+enum class JobPriority : uint8_t
+{
+	FrameCritical = 0,
+	Normal,
+	Background,
+};
+
+static constexpr size_t JobPriorityCount = 3;
+}
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reads many files out of a pack at once, decompressing them in parallel.
+ */
+
+#ifndef CAM_JOBS_PACKLOAD_HPP
+#define CAM_JOBS_PACKLOAD_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include "WorkerPool.hpp"
+#include "../Utils/Pack.hpp"
+
+namespace CAM
+{
+namespace Jobs
+{
+// (*out)[i] gets entries[i]'s contents. Like ParallelFor, returns a job for
+// you to make things depend on then submit. pack and out must outlive it.
+[[nodiscard]] inline std::unique_ptr<Job> LoadFromPack
+(
+	WorkerPool* wp,
+	const Utils::PackReader* pack,
+	std::vector<const Utils::PackEntry*> entries,
+	std::vector<std::vector<std::byte>>* out
+)
+{
+	out->resize(entries.size());
+
+	// Entries vary wildly in size, so one at a time.
+	size_t count = entries.size();
+	return wp->ParallelFor
+	(
+		0,
+		count,
+		1,
+		[pack, entries = std::move(entries), out] (size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				(*out)[i] = pack->Read(*entries[i]);
+			}
+		}
+	);
+}
+}
+}
+
+#endif
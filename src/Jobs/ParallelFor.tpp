@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * WorkerPool::ParallelFor and WorkerPool::ParallelReduce. Included by
+ * WorkerPool.hpp, don't include it yourself.
+ *
+ * A loop starts as one job covering the whole range. The job runs the range
+ * grain items at a time, but whenever its worker's queue is empty it first
+ * splits off the back half of what's left into a new job on that queue. So
+ * ranges are only split while other workers are stealing them, and a loop
+ * nobody steals from runs in grain sized chunks on one worker.
+ *
+ * Split off jobs take on the dependents of the job they were split from, so
+ * anything depending on the loop's job waits for the whole range.
+ */
+
+#ifndef CAM_JOBS_PARALLELFOR_TPP
+#define CAM_JOBS_PARALLELFOR_TPP
+
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+namespace CAM
+{
+namespace Jobs
+{
+template<typename Fn>
+struct ParallelForState
+{
+	Fn fn;
+	size_t grain;
+};
+
+template<typename T, typename Map, typename Reduce>
+struct ParallelReduceState
+{
+	ParallelReduceState(Map map, Reduce reduce, T identity, T* result, size_t grain)
+		: map(std::move(map)), reduce(std::move(reduce)), identity(std::move(identity)), result(result), grain(grain)
+	{}
+
+	Map map;
+	Reduce reduce;
+	T identity;
+	T* result;
+	size_t grain;
+	std::mutex resultMutex;
+};
+}
+}
+
+template<typename Fn>
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::WorkerPool::ParallelFor(size_t begin, size_t end, size_t grain, Fn fn)
+{
+	auto state = std::make_shared<ParallelForState<Fn>>(ParallelForState<Fn>{std::move(fn), std::max<size_t>(grain, 1)});
+	return ParallelForJob(std::move(state), begin, end);
+}
+
+template<typename State>
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::WorkerPool::ParallelForJob(std::shared_ptr<State> state, size_t begin, size_t end)
+{
+	return GetJob
+	(
+		[state = std::move(state), begin, end] (WorkerPool* wp, size_t, Job* thisJob)
+		{
+			wp->SplitRange
+			(
+				begin,
+				end,
+				state->grain,
+				thisJob,
+				[wp, &state] (size_t b, size_t e) { return wp->ParallelForJob(state, b, e); },
+				[&state] (size_t b, size_t e) { state->fn(b, e); }
+			);
+		},
+		0,
+		false
+	);
+}
+
+template<typename T, typename Map, typename Reduce>
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::WorkerPool::ParallelReduce(size_t begin, size_t end, size_t grain, T* result, T identity, Map map, Reduce reduce)
+{
+	using State = ParallelReduceState<T, Map, Reduce>;
+
+	*result = identity;
+	auto state = std::make_shared<State>(std::move(map), std::move(reduce), std::move(identity), result, std::max<size_t>(grain, 1));
+	return ParallelReduceJob(std::move(state), begin, end);
+}
+
+template<typename State>
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::WorkerPool::ParallelReduceJob(std::shared_ptr<State> state, size_t begin, size_t end)
+{
+	return GetJob
+	(
+		[state = std::move(state), begin, end] (WorkerPool* wp, size_t, Job* thisJob)
+		{
+			// Reduce our share locally so we only take the lock once.
+			auto acc = state->identity;
+			wp->SplitRange
+			(
+				begin,
+				end,
+				state->grain,
+				thisJob,
+				[wp, &state] (size_t b, size_t e) { return wp->ParallelReduceJob(state, b, e); },
+				[&state, &acc] (size_t b, size_t e) { acc = state->reduce(std::move(acc), state->map(b, e)); }
+			);
+
+			std::lock_guard<std::mutex> lock(state->resultMutex);
+			*state->result = state->reduce(std::move(*state->result), std::move(acc));
+		},
+		0,
+		false
+	);
+}
+
+template<typename MakeJob, typename Body>
+void CAM::Jobs::WorkerPool::SplitRange(size_t begin, size_t end, size_t grain, Job* thisJob, MakeJob&& makeJob, Body&& body)
+{
+	if (end < begin)
+	{
+		return;
+	}
+
+	Worker* worker = Worker::Current();
+	while (end - begin > grain)
+	{
+		// Someone stole the last half we split off, so they may want more.
+		if (worker != nullptr && worker->JobPoolNoRunnableJobs())
+		{
+			size_t mid = begin + (end - begin) / 2;
+			auto half = makeJob(mid, end);
+			half->SameThingsDependOnMeAs(thisJob);
+			worker->SubmitJob(std::move(half));
+			end = mid;
+			continue;
+		}
+
+		body(begin, begin + grain);
+		begin += grain;
+	}
+
+	if (begin != end)
+	{
+		body(begin, end);
+	}
+}
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Coroutines on top of the WorkerPool. Instead of wiring jobs together by hand
+ * you can write:
+ *
+ *	Jobs::Task Foo(Jobs::WorkerPool* wp)
+ *	{
+ *		co_await wp->Schedule([] (Jobs::WorkerPool*, size_t, Jobs::Job*) { ... });
+ *		co_await Jobs::WhenAll(wp->Schedule(a), wp->Schedule(b));
+ *		co_await Jobs::MainThread();
+ *		co_await Bar(); // Another Task
+ *	}
+ *
+ *	Jobs::Spawn(wp, Foo(wp), thisJob);
+ *
+ * A Task does nothing till it is either co_awaited or Spawn-ed. Spawn-ing it
+ * with thisJob makes everything which depends on thisJob also wait for the
+ * Task to finish.
+ *
+ * Whenever a Task is suspended it is resumed by a job submitted to the
+ * WorkerPool, so it may continue on a different worker. Frames come from
+ * TaskFramePool, which caches them per thread.
+ */
+
+#ifndef CAM_JOBS_TASK_HPP
+#define CAM_JOBS_TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <new>
+
+#include "Job.hpp"
+#include "WorkerPool.hpp"
+
+namespace CAM
+{
+namespace Jobs
+{
+class TaskFramePool
+{
+	public:
+	static constexpr size_t granularity = 64;
+	static constexpr size_t buckets = 32; // So frames up to 2KiB are cached
+	static constexpr size_t maxCached = 64;
+
+	[[nodiscard]] static inline void* Allocate(size_t size)
+	{
+		size_t bucket = (size + granularity - 1) / granularity;
+		if (bucket >= buckets)
+		{
+			return ::operator new(size);
+		}
+
+		auto& list = FreeLists().lists[bucket];
+		if (list.empty())
+		{
+			return ::operator new(bucket * granularity);
+		}
+
+		void* ret = list.back();
+		list.pop_back();
+		return ret;
+	}
+
+	static inline void Free(void* ptr, size_t size)
+	{
+		size_t bucket = (size + granularity - 1) / granularity;
+		if (bucket >= buckets)
+		{
+			::operator delete(ptr);
+			return;
+		}
+
+		auto& list = FreeLists().lists[bucket];
+		if (list.size() >= maxCached)
+		{
+			::operator delete(ptr);
+			return;
+		}
+
+		if (list.capacity() == 0)
+		{
+			list.reserve(maxCached);
+		}
+		list.push_back(ptr);
+	}
+
+	private:
+	struct Lists
+	{
+		~Lists()
+		{
+			for (auto& list : lists)
+			{
+				for (auto ptr : list)
+				{
+					::operator delete(ptr);
+				}
+			}
+		}
+
+		std::array<std::vector<void*>, buckets> lists;
+	};
+
+	[[nodiscard]] static inline Lists& FreeLists()
+	{
+		static thread_local Lists lists;
+		return lists;
+	}
+};
+
+class Task
+{
+	public:
+	struct promise_type;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	struct FinalAwaiter
+	{
+		inline bool await_ready() const noexcept { return false; }
+		inline void await_suspend(Handle h) noexcept
+		{
+			// Once submitted the completion job may destroy us at any time, so
+			// don't touch the frame afterwards.
+			auto wp = h.promise().wp;
+			auto completion = std::move(h.promise().completion);
+
+			// We can't throw from here, and nothing would ever resume us.
+			if (!wp->SubmitJob(std::move(completion))) { std::terminate(); }
+		}
+		inline void await_resume() const noexcept {}
+	};
+
+	struct promise_type
+	{
+		inline Task get_return_object() { return Task(Handle::from_promise(*this)); }
+		inline std::suspend_always initial_suspend() const noexcept { return {}; }
+		inline FinalAwaiter final_suspend() const noexcept { return {}; }
+		inline void return_void() const {}
+		inline void unhandled_exception() { exception = std::current_exception(); }
+
+		[[nodiscard]] static inline void* operator new(size_t size) { return TaskFramePool::Allocate(size); }
+		static inline void operator delete(void* ptr, size_t size) { TaskFramePool::Free(ptr, size); }
+
+		WorkerPool* wp = nullptr;
+		std::coroutine_handle<> continuation;
+		std::exception_ptr exception;
+		std::unique_ptr<Job> completion;
+	};
+
+	struct Awaiter
+	{
+		inline bool await_ready() const noexcept { return false; }
+		inline Handle await_suspend(Handle parent)
+		{
+			Prepare(child, parent.promise().wp, parent);
+			return child;
+		}
+		inline void await_resume()
+		{
+			auto exception = child.promise().exception;
+			child.destroy();
+			if (exception != nullptr)
+			{
+				std::rethrow_exception(exception);
+			}
+		}
+
+		Handle child;
+	};
+
+	inline Task(Task&& other) : handle(other.Release()) {}
+	inline Task& operator=(Task&& other)
+	{
+		if (this != &other)
+		{
+			if (handle) { handle.destroy(); }
+			handle = other.Release();
+		}
+		return *this;
+	}
+	inline ~Task() { if (handle) { handle.destroy(); } }
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&)& = delete;
+
+	inline Awaiter operator co_await() && { return Awaiter{Release()}; }
+
+	[[nodiscard]] inline Handle Release()
+	{
+		auto ret = handle;
+		handle = nullptr;
+		return ret;
+	}
+
+	// Gives the task its WorkerPool and the job which finishes it. That job
+	// resumes continuation if there is one, else it destroys the frame.
+	static inline void Prepare(Handle h, WorkerPool* wp, std::coroutine_handle<> continuation)
+	{
+		auto& p = h.promise();
+		p.wp = wp;
+		p.continuation = continuation;
+		p.completion = wp->GetJob
+		(
+			[h] (WorkerPool*, size_t, Job*)
+			{
+				auto continuation = h.promise().continuation;
+				if (continuation)
+				{
+					// The awaiter cleans up
+					continuation.resume();
+					return;
+				}
+
+				auto exception = h.promise().exception;
+				h.destroy();
+				if (exception != nullptr)
+				{
+					std::rethrow_exception(exception);
+				}
+			},
+			0,
+			false
+		);
+	}
+
+	private:
+	inline explicit Task(Handle handle) : handle(handle) {}
+
+	Handle handle;
+};
+
+class ScheduleAwaitable
+{
+	public:
+	inline ScheduleAwaitable(WorkerPool* wp, JobD::JobFunc func, bool mainThreadOnly)
+		: wp(wp), func(std::move(func)), mainThreadOnly(mainThreadOnly)
+	{}
+
+	inline bool await_ready() const noexcept { return false; }
+	inline void await_suspend(std::coroutine_handle<> h)
+	{
+		// Once job is submitted we may be resumed and destroyed at any time.
+		auto wp = this->wp;
+		auto resumeJob = ResumeJob(wp, h);
+		auto job = MakeJob();
+
+		resumeJob->DependsOn(job.get());
+		if (!wp->SubmitJob(std::move(resumeJob))) { throw std::runtime_error("Could not submit job\n"); }
+		if (!wp->SubmitJob(std::move(job))) { throw std::runtime_error("Could not submit job\n"); }
+	}
+	inline void await_resume() const noexcept {}
+
+	[[nodiscard]] inline std::unique_ptr<Job> MakeJob()
+	{
+		return wp->GetJob(std::move(func), 0, mainThreadOnly);
+	}
+
+	[[nodiscard]] static inline std::unique_ptr<Job> ResumeJob(WorkerPool* wp, std::coroutine_handle<> h, bool mainThreadOnly = false)
+	{
+		return wp->GetJob
+		(
+			[h] (WorkerPool*, size_t, Job*)
+			{
+				h.resume();
+			},
+			0,
+			mainThreadOnly
+		);
+	}
+
+	WorkerPool* wp;
+
+	private:
+	JobD::JobFunc func;
+	bool mainThreadOnly;
+};
+
+template<size_t N>
+class WhenAllAwaitable
+{
+	public:
+	inline bool await_ready() const noexcept { return N == 0; }
+	inline void await_suspend(std::coroutine_handle<> h)
+	{
+		auto wp = awaitables[0].wp;
+		auto resumeJob = ScheduleAwaitable::ResumeJob(wp, h);
+
+		std::array<std::unique_ptr<Job>, N> jobs;
+		for (size_t i = 0; i < N; ++i)
+		{
+			jobs[i] = awaitables[i].MakeJob();
+			resumeJob->DependsOn(jobs[i].get());
+		}
+
+		if (!wp->SubmitJob(std::move(resumeJob))) { throw std::runtime_error("Could not submit job\n"); }
+		for (auto& job : jobs)
+		{
+			if (!wp->SubmitJob(std::move(job))) { throw std::runtime_error("Could not submit job\n"); }
+		}
+	}
+	inline void await_resume() const noexcept {}
+
+	std::array<ScheduleAwaitable, N> awaitables;
+};
+
+// Runs all the passed WorkerPool::Schedule-s in parallel, resuming once they
+// are all done.
+template<typename... Awaitables>
+[[nodiscard]] inline WhenAllAwaitable<sizeof...(Awaitables)> WhenAll(Awaitables&&... awaitables)
+{
+	return WhenAllAwaitable<sizeof...(Awaitables)>{{std::forward<Awaitables>(awaitables)...}};
+}
+
+class MainThreadAwaitable
+{
+	public:
+	inline bool await_ready() const noexcept { return false; }
+	inline void await_suspend(Task::Handle h)
+	{
+		auto wp = h.promise().wp;
+		if (!wp->SubmitJob(ScheduleAwaitable::ResumeJob(wp, h, true))) { throw std::runtime_error("Could not submit job\n"); }
+	}
+	inline void await_resume() const noexcept {}
+};
+
+// Continues the Task on the main thread.
+[[nodiscard]] inline MainThreadAwaitable MainThread() { return {}; }
+
+// Starts task on a worker. If thisJob is passed, the things which depend on it
+// will also depend on task finishing.
+inline void Spawn(WorkerPool* wp, Task task, Job* thisJob = nullptr)
+{
+	auto h = task.Release();
+	Task::Prepare(h, wp, nullptr);
+
+	if (thisJob != nullptr)
+	{
+		h.promise().completion->SameThingsDependOnMeAs(thisJob);
+	}
+
+	if (!wp->SubmitJob(ScheduleAwaitable::ResumeJob(wp, h))) { throw std::runtime_error("Could not submit job\n"); }
+}
+}
+}
+
+inline CAM::Jobs::ScheduleAwaitable CAM::Jobs::WorkerPool::Schedule(JobD::JobFunc func, bool mainThreadOnly)
+{
+	return ScheduleAwaitable(this, std::move(func), mainThreadOnly);
+}
+
+#endif
@@ -21,9 +21,17 @@
 #include "WorkerPool.hpp"
 #include "Job.hpp"
 #include "../Utils/Assert.hpp"
+#include "../Utils/CpuTopology.hpp"
+#include "../Utils/Epoch.hpp"
+#include "../Utils/Profiler.hpp"
+#include "../Config.hpp"
 
-CAM::Jobs::Worker::Worker(WorkerPool* owner, bool background)
-	: owner(owner), background(background), jobs(owner)
+#include <algorithm>
+
+thread_local CAM::Jobs::Worker* CAM::Jobs::Worker::current = nullptr;
+
+CAM::Jobs::Worker::Worker(WorkerPool* owner, bool background, int cpu)
+	: owner(owner), background(background), cpu(cpu), jobs(owner)
 {
 	static size_t lastThreadNumber = 0;
 	threadNumber = lastThreadNumber;
@@ -33,10 +41,7 @@ CAM::Jobs::Worker::Worker(WorkerPool* owner, bool background)
 CAM::Jobs::Worker::~Worker()
 {
 	RequestInactivity(); // just in case
-	if (background)
-	{
-		thisThread->join();
-	}
+	Join();
 }
 
 void CAM::Jobs::Worker::StartThread()
@@ -60,41 +65,78 @@ void CAM::Jobs::Worker::SubmitJob(std::unique_ptr<Job> job)
 	jobs.SubmitJob(std::move(job));
 }
 
+size_t CAM::Jobs::Worker::SubmitJobs(std::unique_ptr<Job>* batch, size_t count)
+{
+	return jobs.SubmitJobs(batch, count);
+}
+
 std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::Worker::PullJob()
 {
 	return jobs.PullJob();
 }
 
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::Worker::StealJob(JobPool& into, JobPriority atLeast)
+{
+	return jobs.StealJob(into, atLeast);
+}
+
 void CAM::Jobs::Worker::WorkerRoutine()
 {
-	auto idleLock = owner->InFlightLock();
+	current = this;
+	Utils::Fiber::SetWake(&wake);
+	CAM_PROFILE_THREAD((background ? "Worker " : "Main worker ") + std::to_string(threadNumber));
+	if (!Utils::CpuTopology::PinThisThread(cpu))
+	{
+		printf("%zu: Could not pin to CPU %i\n", threadNumber, cpu);
+	}
+
+	jobs.BindToThisThread();
+	if (!background)
+	{
+		owner->MainThreadJobs().BindToThisThread();
+	}
+
+	// We hold no other jobs between jobs, so finished jobs may be recycled.
+	// Jobs themselves run outside of the epoch, see RunJob.
+	Utils::Epoch::Guard epoch;
 	std::unique_ptr<Job> retJob = nullptr;
 	while (run.load(std::memory_order_acquire))
 	{
+		Utils::Epoch::Quiesce();
 		if (retJob != nullptr)
 		{
 			ASSERT(retJob->CanRun(), "Sync error, should be runnable.");
 			if (background && retJob->MainThreadOnly())
 			{
-				// Resubmit to the worker pool since we can't do it.
+				// Resubmit to the worker pool since we can't do it. It was
+				// counted again by that, so uncount it here.
 				if (!owner->SubmitJob(std::move(retJob))) { throw std::runtime_error("Could not submit job\n"); }
+				owner->JobFinished();
 			}
 			else if (!background && !retJob->MainThreadOnly() && !owner->MainThreadJobs().NoRunnableJobs())
 			{
 				// Do a main-thread job instead
 				if (!owner->SubmitJob(std::move(retJob))) { throw std::runtime_error("Could not submit job\n"); }
+				owner->JobFinished();
 				retJob = owner->MainThreadJobs().PullJob();
 				continue;
 			}
 			else
 			{
-				auto newRetJob = retJob->DoJob(owner, threadNumber);
-				owner->ReturnJob(std::move(retJob));
-				std::swap(retJob, newRetJob);
+				retJob = RunJob(std::move(retJob));
 			}
 			continue;
 		}
 
+		if (!suspendedFibers.empty())
+		{
+			retJob = ResumeReadyFibers();
+			if (retJob != nullptr)
+			{
+				continue;
+			}
+		}
+
 		if (!background && !owner->MainThreadJobs().NoRunnableJobs())
 		{
 			retJob = owner->MainThreadJobs().PullJob();
@@ -103,64 +145,229 @@ void CAM::Jobs::Worker::WorkerRoutine()
 
 		if (jobs.NoRunnableJobs())
 		{
-			retJob = owner->TryPullingJob(background).first;
+			retJob = owner->TryPullingJob(background, jobs);
+
+			if (retJob == nullptr && !suspendedFibers.empty())
+			{
+				// We can't go idle while some of our jobs are only half done,
+				// but we can sleep till one of them might carry on.
+				ParkWithFibers();
+				continue;
+			}
 
 			if (retJob == nullptr)
 			{
-				idleLock = nullptr;
+				bool woken = false;
 				while (retJob == nullptr)
 				{
-					bool njobs;
-					if(!background && (njobs = owner->NoJobs()))
+					Utils::Epoch::Quiesce();
+					if (!background && owner->NoJobs())
 					{
 						printf("%zu: Main left\n", threadNumber);
+						current = nullptr;
+						Utils::Fiber::SetWake(nullptr);
 						return;
 					}
 
 					if (!run.load(std::memory_order_acquire))
 					{
 						printf("%zu: Thread left\n", threadNumber);
+						current = nullptr;
+						Utils::Fiber::SetWake(nullptr);
 						return;
 					}
 
 					if (!jobs.NoRunnableJobs())
 					{
-						idleLock = owner->InFlightLock();
 						retJob = PullJob();
-
-						if (retJob == nullptr)
-						{
-							idleLock = nullptr;
-						}
 						continue;
 					}
 
-					auto ret = owner->TryPullingJob(background);
-
-					if (ret.first != nullptr && ret.second != nullptr)
+					retJob = owner->TryPullingJob(background, jobs);
+					if (retJob != nullptr)
 					{
-						idleLock = std::move(ret.second);
-						retJob = std::move(ret.first);
 						continue;
 					}
 
 					if (background)
 					{
-						ASSERT(idleLock == nullptr, "We should only be waiting for a new job after desposing of our idleLock.");
-						cc.Wait();
+						if (woken)
+						{
+							owner->CountEmptyWakeup();
+						}
+
+						owner->MarkIdle(index);
+						Utils::Epoch::Leave();
+						wake.Wait([this]
+						{
+							return !run.load(std::memory_order_acquire)
+								|| !jobs.NoRunnableJobs()
+								|| owner->AnyRunnableJobs();
+						});
+						Utils::Epoch::Enter();
+						owner->MarkBusy(index);
+						woken = true;
 					}
 				}
 			}
 			continue;
 		}
 
+		// Someone else's frame-critical jobs go before our lesser ones.
+		if
+		(
+			owner->FrameCriticalJobsQueued() != 0
+			&& !jobs.HasRunnableJobs(JobPriority::FrameCritical)
+		)
+		{
+			retJob = owner->TryPullingJob(background, jobs, JobPriority::FrameCritical);
+			if (retJob != nullptr)
+			{
+				continue;
+			}
+		}
+
 		retJob = PullJob();
 	}
 
 	printf("%zu: Thread left\n", threadNumber);
+	current = nullptr;
+	Utils::Fiber::SetWake(nullptr);
 	return;
 }
 
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::Worker::RunJob(std::unique_ptr<Job> job)
+{
+	if (!Config::FibersEnabled)
+	{
+		// Jobs may take as long as they like, and we mustn't hold everyone's
+		// reclamation up meanwhile.
+		Utils::Epoch::Leave();
+		std::unique_ptr<Job> newRetJob;
+		{
+			CAM_PROFILE_SCOPE("Job");
+			newRetJob = job->DoJob(owner, threadNumber);
+		}
+		owner->ReturnJob(std::move(job));
+		owner->JobFinished();
+		Utils::Epoch::Enter();
+		return newRetJob;
+	}
+
+	Utils::Fiber* fiber;
+	if (freeFibers.empty())
+	{
+		fibers.push_back(std::make_unique<Utils::Fiber>(Config::FiberStackSize));
+		fiber = fibers.back().get();
+	}
+	else
+	{
+		fiber = freeFibers.back();
+		freeFibers.pop_back();
+	}
+
+	fiber->Reset([this, jobP = job.release()]
+	{
+		std::unique_ptr<Job> job(jobP);
+		fiberRetJob = job->DoJob(owner, threadNumber);
+		owner->ReturnJob(std::move(job));
+		owner->JobFinished();
+	});
+
+	return ResumeFiber(fiber);
+}
+
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::Worker::ResumeFiber(Utils::Fiber* fiber)
+{
+	// Outside the epoch like in RunJob. Suspended fibers hold nothing it
+	// protects either, so we can Quiesce while they're suspended.
+	Utils::Epoch::Leave();
+	{
+		// Each stretch of a job between waits is a zone of its own, as other
+		// jobs run in between.
+		CAM_PROFILE_SCOPE("Job");
+		fiber->Resume();
+	}
+	Utils::Epoch::Enter();
+
+	if (fiber->Finished())
+	{
+		freeFibers.push_back(fiber);
+		return std::move(fiberRetJob);
+	}
+
+	suspendedFibers.push_back(fiber);
+	return nullptr;
+}
+
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::Worker::ResumeReadyFibers()
+{
+	size_t i = 0;
+	while (i < suspendedFibers.size())
+	{
+		auto fiber = suspendedFibers[i];
+		if (!fiber->CanResume())
+		{
+			++i;
+			continue;
+		}
+
+		suspendedFibers[i] = suspendedFibers.back();
+		suspendedFibers.pop_back();
+
+		auto ret = ResumeFiber(fiber);
+		if (ret != nullptr)
+		{
+			return ret;
+		}
+	}
+
+	return nullptr;
+}
+
+// Fibers waiting on jobs have those notify wake, see Utils::Fiber::YieldUntil.
+// Ones waiting on anything else we have to keep checking, backing off while
+// none are ready.
+void CAM::Jobs::Worker::ParkWithFibers()
+{
+	auto pred = [this]
+	{
+		return !run.load(std::memory_order_acquire)
+			|| !jobs.NoRunnableJobs()
+			|| (!background && !owner->MainThreadJobs().NoRunnableJobs())
+			|| owner->AnyRunnableJobs()
+			|| std::any_of
+			(
+				std::begin(suspendedFibers),
+				std::end(suspendedFibers),
+				[] (Utils::Fiber* fiber) { return fiber->CanResume(); }
+			);
+	};
+	bool allNotify = std::all_of
+	(
+		std::begin(suspendedFibers),
+		std::end(suspendedFibers),
+		[] (Utils::Fiber* fiber) { return fiber->WillNotify(); }
+	);
+
+	owner->MarkIdle(index);
+	Utils::Epoch::Leave();
+	if (allNotify)
+	{
+		wake.Wait(pred);
+	}
+	else if (wake.WaitFor(pred, fiberPoll))
+	{
+		fiberPoll = std::chrono::microseconds(Config::FiberPollMinMicroseconds);
+	}
+	else
+	{
+		fiberPoll = std::min(fiberPoll * 2, std::chrono::microseconds(Config::FiberPollMaxMicroseconds));
+	}
+	Utils::Epoch::Enter();
+	owner->MarkBusy(index);
+}
+
 bool CAM::Jobs::Worker::JobPoolEmpty() const
 {
 	return jobs.Empty();
@@ -171,13 +378,38 @@ bool CAM::Jobs::Worker::JobPoolNoRunnableJobs() const
 	return jobs.NoRunnableJobs();
 }
 
+size_t CAM::Jobs::Worker::JobPoolRunnableJobsLeft() const
+{
+	return jobs.RunnableJobsLeft();
+}
+
+bool CAM::Jobs::Worker::JobPoolHasRunnableJobs(JobPriority atLeast) const
+{
+	for (size_t i = 0; i <= static_cast<size_t>(atLeast); ++i)
+	{
+		if (jobs.HasRunnableJobs(static_cast<JobPriority>(i)))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 void CAM::Jobs::Worker::RequestInactivity()
 {
 	run.store(false, std::memory_order_release);
-	cc.Reset();
+	wake.NotifyAll();
+}
+
+void CAM::Jobs::Worker::Join()
+{
+	if (thisThread != nullptr && thisThread->joinable())
+	{
+		thisThread->join();
+	}
 }
 
 void CAM::Jobs::Worker::WakeUp()
 {
-	cc.Signal();
+	wake.NotifyOne();
 }
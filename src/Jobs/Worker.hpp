@@ -23,6 +23,12 @@
  *
  * Each worker owns its own pool, which it draws jobs from until empty. It will
  * then try to draw jobs from other job pools, maybe butchering performance.
+ * Those other pools are tried closest first, so we'd rather steal from a
+ * worker sharing our caches.
+ *
+ * If Config::FibersEnabled, every job is run on a fiber. Jobs which need to
+ * wait on another job suspend their fiber instead of blocking the thread, and
+ * the worker goes off to do other jobs till they can be resumed.
  */
 
 #ifndef CAM_JOBS_THREAD_HPP
@@ -30,13 +36,17 @@
 
 #include <vector>
 #include <atomic>
+#include <chrono>
 #include <thread>
 #include <cstdint>
 #include <shared_mutex>
 #include <mutex>
+#include <functional>
 
-#include "../Utils/ConditionalContinue.hpp"
+#include "../Utils/EventCount.hpp"
+#include "../Utils/Fiber.hpp"
 #include "JobPool.hpp"
+#include "../Config.hpp"
 
 namespace CAM
 {
@@ -48,7 +58,8 @@ class Job;
 class Worker
 {
 	public:
-	Worker(WorkerPool* owner, bool background);
+	// cpu is the one to pin our thread to, -1 to let the OS decide.
+	Worker(WorkerPool* owner, bool background, int cpu = -1);
 	~Worker(); // Jobs' jobs arn't returned to the thread pool because its dieing anyways.
 
 	Worker(const Worker&) = default;
@@ -58,30 +69,73 @@ class Worker
 
 	void StartThread();
 	void SubmitJob(std::unique_ptr<Job> job);
-	[[nodiscard]] std::unique_ptr<Job> PullJob();
+	[[nodiscard]] size_t SubmitJobs(std::unique_ptr<Job>* batch, size_t count); // Returns how many were runnable
+	[[nodiscard]] std::unique_ptr<Job> PullJob(); // Only from this worker's thread
+	[[nodiscard]] std::unique_ptr<Job> StealJob(JobPool& into, JobPriority atLeast = JobPriority::Background);
 
 	[[nodiscard]] bool JobPoolEmpty() const;
 	[[nodiscard]] bool JobPoolNoRunnableJobs() const;
+	[[nodiscard]] size_t JobPoolRunnableJobsLeft() const;
+	// True if we have runnable jobs of atLeast's priority or higher.
+	[[nodiscard]] bool JobPoolHasRunnableJobs(JobPriority atLeast) const;
 
 	[[nodiscard]] inline bool IsBackground() const { return background; }
+	[[nodiscard]] inline int Cpu() const { return cpu; }
+	[[nodiscard]] inline WorkerPool* Owner() const { return owner; }
+
+	// Our index in our WorkerPool, set when we are added to it.
+	[[nodiscard]] inline size_t Index() const { return index; }
+	inline void SetIndex(size_t index)
+	{
+		this->index = index;
+		jobs.SetWorkerIndex(static_cast<int>(index));
+	}
+
+	// The indices of the other workers in our WorkerPool, closest first.
+	// Set by the WorkerPool before our thread starts.
+	[[nodiscard]] inline const std::vector<size_t>& Victims() const { return victims; }
+	inline void SetVictims(std::vector<size_t> victims) { this->victims = std::move(victims); }
+
+	// The worker running on this thread, nullptr if none is.
+	[[nodiscard]] static inline Worker* Current() { return current; }
 
 	void RequestInactivity();
+	// Waits for our thread to exit, if we have one. Call RequestInactivity
+	// first.
+	void Join();
 
 	void WakeUp();
 
 	void WorkerRoutine();
 
 	private:
+	[[nodiscard]] std::unique_ptr<Job> RunJob(std::unique_ptr<Job> job);
+	[[nodiscard]] std::unique_ptr<Job> ResumeFiber(Utils::Fiber* fiber);
+	[[nodiscard]] std::unique_ptr<Job> ResumeReadyFibers();
+	void ParkWithFibers();
+
 	size_t threadNumber;
+	size_t index = 0;
 
 	WorkerPool* owner;
 	std::atomic<bool> run = true;
 	std::unique_ptr<std::thread> thisThread;
 	bool background;
+	int cpu;
+	std::vector<size_t> victims;
 
 	JobPool jobs;
 
-	mutable Utils::ConditionalContinue cc;
+	// We park on this when there's nothing to do.
+	Utils::EventCount wake;
+
+	std::vector<std::unique_ptr<Utils::Fiber>> fibers;
+	std::vector<Utils::Fiber*> freeFibers;
+	std::vector<Utils::Fiber*> suspendedFibers;
+	std::unique_ptr<Job> fiberRetJob;
+	std::chrono::microseconds fiberPoll = std::chrono::microseconds(Config::FiberPollMinMicroseconds);
+
+	static thread_local Worker* current;
 };
 }
 }
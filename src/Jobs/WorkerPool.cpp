@@ -18,64 +18,159 @@
  */
 
 #include "WorkerPool.hpp"
+#include "AsyncIO.hpp"
 #include "Job.hpp"
 #include "../Utils/Assert.hpp"
+#include "../Utils/CpuTopology.hpp"
+#include "../Config.hpp"
+
+#include <algorithm>
+
+CAM::Jobs::WorkerPool::WorkerPool() : mainThreadJobs(this)
+{
+	Job::Slab::Get().Reserve(Config::JobSlabReserve);
+}
 
 CAM::Jobs::WorkerPool::~WorkerPool()
 {
 	shutingDown.store(true, std::memory_order_release);
+
+	// Signaling what's in flight makes jobs runnable, so it goes before anyone.
+	asyncIO = nullptr;
+
+	// They may still be making our Workers' jobs runnable, so they go first.
+	if (blockingWorkers != nullptr)
+	{
+		blockingWorkers->Stop();
+	}
 	// We cannot kill any Worker before any other Worker's thread dies else
-	// shenanigans happen. So we wait for all of them to die first.
+	// shenanigans happen, like them stealing from it. So we wait for all of
+	// them to die first.
+	std::unique_lock<std::shared_mutex> lock(workersMutex);
+	for (auto& worker : workers)
 	{
-		auto lock = WorkersLock();
-		while (!lock) { std::this_thread::yield(); lock = WorkersLock(); }
-		for (auto& worker : workers)
-		{
-			worker->RequestInactivity();
-			worker->WakeUp();
-		}
+		worker->RequestInactivity();
+		worker->WakeUp();
 	}
-
-	std::unique_lock<CAM::Utils::CountedSharedMutex> idleLock(inFlightMutex, std::defer_lock);
-	std::unique_lock<std::shared_mutex> lock(workersMutex, std::defer_lock);
-	std::lock(lock, idleLock);
+	for (auto& worker : workers)
+	{
+		worker->Join();
+	}
+	stealableCount.store(0, std::memory_order_release);
 
 	for (auto& worker : workers)
 	{
 		worker = nullptr;
 	}
+	blockingWorkers = nullptr;
+
+	printf("%zu wakeups, %zu of which found nothing to do\n", Wakeups(), EmptyWakeups());
+}
+
+void CAM::Jobs::WorkerPool::StartBlockingWorkers(size_t threadCount, size_t queueCapacity)
+{
+	ASSERT(blockingWorkers == nullptr, "BlockingWorkers were already started.");
+	if (threadCount == 0)
+	{
+		return;
+	}
+
+	std::shared_lock<std::shared_mutex> lock(workersMutex);
+	blockingWorkers = std::make_unique<BlockingWorkers>(this, threadCount, queueCapacity, workers.size());
+}
+
+void CAM::Jobs::WorkerPool::StartAsyncIO(size_t threadCount, size_t queueDepth, size_t bufferCount, size_t bufferSize)
+{
+	ASSERT(asyncIO == nullptr, "AsyncIO was already started.");
+	asyncIO = std::make_unique<AsyncIO>(this, threadCount, queueDepth, bufferCount, bufferSize);
 }
 
 void CAM::Jobs::WorkerPool::AddWorker(std::unique_ptr<Worker> worker)
 {
 	std::unique_lock<std::shared_mutex> lock(workersMutex);
+	ASSERT(workers.size() < maxWorkers, "Too many workers for the idle worker bitmap.");
+	worker->SetIndex(workers.size());
+	stealable[workers.size()] = worker.get();
 	workers.push_back(std::move(worker));
+	stealableCount.store(workers.size(), std::memory_order_release);
 }
 
-void CAM::Jobs::WorkerPool::WakeUpThreads(size_t number)
+void CAM::Jobs::WorkerPool::WakeUpThreads(size_t number, int preferred)
 {
+	// Pairs with MarkIdle, so either we see them idle or they see our job.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	bool anyIdle = false;
+	for (auto& word : idleWorkers)
+	{
+		anyIdle = anyIdle || word.load(std::memory_order_relaxed) != 0;
+	}
+	if (!anyIdle || number == 0)
+	{
+		return;
+	}
+
 	auto lock = WorkersLock();
-	auto wakeUp = ranGen(0, workers.size() - 1);
+	if (!lock)
+	{
+		return;
+	}
+
+	if (preferred >= 0 && WakeUpIfIdle(preferred) && --number == 0)
+	{
+		return;
+	}
 
-	do
+	auto current = Worker::Current();
+	if (current != nullptr && current->Owner() == this)
 	{
-		if (wakeUp >= workers.size())
+		for (auto victim : current->Victims())
 		{
-			wakeUp = 0;
+			if (WakeUpIfIdle(victim) && --number == 0)
+			{
+				return;
+			}
 		}
+		return;
+	}
 
-		if (workers[wakeUp] != nullptr)
+	for (size_t i = 0; i < idleWorkers.size(); ++i)
+	{
+		uint64_t word;
+		while ((word = idleWorkers[i].load(std::memory_order_relaxed)) != 0)
 		{
-			workers[wakeUp]->WakeUp();
-			--number;
+			if (WakeUpIfIdle(i * 64 + __builtin_ctzll(word)) && --number == 0)
+			{
+				return;
+			}
 		}
-		++wakeUp;
-	} while (number > 0);
+	}
 }
 
-// TODO: Submit jobs Round-Robin-ly
-// Or maybe a smarter algo which tries to hit the same threads until they have
-// no idle time
+bool CAM::Jobs::WorkerPool::WakeUpIfIdle(size_t worker)
+{
+	if (worker >= workers.size() || workers[worker] == nullptr)
+	{
+		return false;
+	}
+
+	uint64_t bit = uint64_t(1) << (worker % 64);
+	if ((idleWorkers[worker / 64].fetch_and(~bit, std::memory_order_acq_rel) & bit) == 0)
+	{
+		return false; // Already awake, or someone else got them
+	}
+
+	wakeups.fetch_add(1, std::memory_order_relaxed);
+	workers[worker]->WakeUp();
+	return true;
+}
+
+// Jobs go, in order of preference, to:
+//	- the worker they have an affinity for,
+//	- the worker submitting them, so their data stays in its caches, unless it
+//	has more than Config::LocalQueueLimit jobs queued already,
+//	- the closest idle worker to the submitter,
+//	- the next worker, round-robin.
 bool CAM::Jobs::WorkerPool::SubmitJob(std::unique_ptr<Job> job)
 {
 	if (shutingDown.load(std::memory_order_acquire))
@@ -83,9 +178,15 @@ bool CAM::Jobs::WorkerPool::SubmitJob(std::unique_ptr<Job> job)
 		return true; // Wasn't actually submited, but they don't need to know that
 	}
 
-	auto idleLock = InFlightLock();
 	ASSERT(job != nullptr, "A nullptr job was attempted to be submitted to the WorkerPool. This shouldn't happen.");
 
+	if (job->Blocking() && job->CanRun() && blockingWorkers != nullptr)
+	{
+		JobsSubmitted(1);
+		blockingWorkers->Submit(std::move(job));
+		return true;
+	}
+
 	if (job->MainThreadOnly())
 	{
 		mainThreadJobs.SubmitJob(std::move(job));
@@ -94,82 +195,251 @@ bool CAM::Jobs::WorkerPool::SubmitJob(std::unique_ptr<Job> job)
 	}
 
 	auto lock = WorkersLock();
-	auto submitPool = ranGen(0, workers.size() - 1);
+	if (workers.empty())
+	{
+		return false;
+	}
 
-	bool first = true;
-	do
+	int affinity = job->Affinity();
+	if (affinity >= 0 && static_cast<size_t>(affinity) < workers.size() && workers[affinity] != nullptr)
 	{
-		if (submitPool >= workers.size())
+		workers[affinity]->SubmitJob(std::move(job));
+		return true;
+	}
+
+	auto current = Worker::Current();
+	if (current != nullptr && current->Owner() == this)
+	{
+		if (current->JobPoolRunnableJobsLeft() < Config::LocalQueueLimit)
 		{
-			if (!first)
+			current->SubmitJob(std::move(job));
+			return true;
+		}
+
+		for (auto victim : current->Victims())
+		{
+			if (IsIdle(victim) && workers[victim] != nullptr)
 			{
-				return false;
+				workers[victim]->SubmitJob(std::move(job));
+				return true;
 			}
-			submitPool = 0;
-			first = false;
 		}
+	}
 
-		if (workers[submitPool] != nullptr)
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		size_t submitPool = nextSubmitPool.fetch_add(1, std::memory_order_relaxed) % workers.size();
+		if (workers[submitPool] != nullptr && workers[submitPool].get() != current)
 		{
 			workers[submitPool]->SubmitJob(std::move(job));
-			workers[submitPool]->WakeUp();
 			return true;
 		}
-		++submitPool;
-	} while (true);
+	}
+
+	if (current != nullptr && current->Owner() == this)
+	{
+		current->SubmitJob(std::move(job));
+		return true;
+	}
+
+	return false;
 }
 
-CAM::Jobs::WorkerPool::JobLockPair CAM::Jobs::WorkerPool::TryPullingJob(bool background)
+bool CAM::Jobs::WorkerPool::SubmitJobs(std::unique_ptr<Job>* batch, size_t count)
 {
 	if (shutingDown.load(std::memory_order_acquire))
 	{
-		return WorkerPool::JobLockPair(nullptr, nullptr);
+		return true; // Wasn't actually submited, but they don't need to know that
 	}
 
+	auto lock = WorkersLock();
+	if (workers.empty())
 	{
-		auto idleLock = InFlightLock();
-		if (!background && !mainThreadJobs.NoRunnableJobs())
+		return false;
+	}
+
+	// Sort the jobs into one bucket per pool, the last being the main thread's.
+	static thread_local std::vector<std::vector<std::unique_ptr<Job>>> buckets;
+	if (buckets.size() < workers.size() + 1)
+	{
+		buckets.resize(workers.size() + 1);
+	}
+	auto& mainBucket = buckets[workers.size()];
+
+	// Same preferences as SubmitJob, except jobs which don't fit locally are
+	// dealt out over the idle workers, or everyone if nobody is idle.
+	auto current = Worker::Current();
+	bool local = current != nullptr && current->Owner() == this;
+	size_t localRoom = 0;
+	if (local)
+	{
+		size_t left = current->JobPoolRunnableJobsLeft();
+		localRoom = left < Config::LocalQueueLimit ? Config::LocalQueueLimit - left : 0;
+	}
+
+	static thread_local std::vector<size_t> spill;
+	spill.clear();
+	if (local)
+	{
+		for (auto victim : current->Victims())
+		{
+			if (IsIdle(victim) && workers[victim] != nullptr) { spill.push_back(victim); }
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < workers.size(); ++i)
 		{
-			auto ret = mainThreadJobs.PullJob();
-			return WorkerPool::JobLockPair(std::move(ret), std::move(idleLock));
+			if (IsIdle(i) && workers[i] != nullptr) { spill.push_back(i); }
 		}
 	}
+	if (spill.empty())
+	{
+		size_t start = nextSubmitPool.fetch_add(count, std::memory_order_relaxed);
+		for (size_t i = 0; i < workers.size(); ++i)
+		{
+			size_t pool = (start + i) % workers.size();
+			if (workers[pool] != nullptr && workers[pool].get() != current) { spill.push_back(pool); }
+		}
+	}
+	if (spill.empty())
+	{
+		if (!local)
+		{
+			return false;
+		}
+		spill.push_back(current->Index());
+	}
 
-	int pullPool = FindPullablePool();
-	if (pullPool == -1)
+	// Submitted once we've let go of everything, since submitting them may
+	// wait. Not thread_local, as waiting may let another fiber in here.
+	std::vector<std::unique_ptr<Job>> blocking;
+
+	size_t nextSpill = 0;
+	for (size_t i = 0; i < count; ++i)
 	{
-		return WorkerPool::JobLockPair(nullptr, nullptr);
+		auto& job = batch[i];
+		ASSERT(job != nullptr, "A nullptr job was attempted to be submitted to the WorkerPool. This shouldn't happen.");
+
+		if (job->Blocking() && job->CanRun() && blockingWorkers != nullptr)
+		{
+			blocking.push_back(std::move(job));
+			continue;
+		}
+
+		if (job->MainThreadOnly())
+		{
+			mainBucket.push_back(std::move(job));
+			continue;
+		}
+
+		int affinity = job->Affinity();
+		if (affinity >= 0 && static_cast<size_t>(affinity) < workers.size() && workers[affinity] != nullptr)
+		{
+			buckets[affinity].push_back(std::move(job));
+		}
+		else if (localRoom > 0)
+		{
+			buckets[current->Index()].push_back(std::move(job));
+			--localRoom;
+		}
+		else
+		{
+			buckets[spill[nextSpill]].push_back(std::move(job));
+			nextSpill = (nextSpill + 1) % spill.size();
+		}
+	}
+
+	size_t runnable = 0;
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		auto& bucket = buckets[i];
+		if (bucket.empty())
+		{
+			continue;
+		}
+
+		ASSERT(workers[i] != nullptr, "Jobs should only be bucketed for live workers.");
+		runnable += workers[i]->SubmitJobs(bucket.data(), bucket.size());
+		bucket.clear();
 	}
-	auto idleLock = InFlightLock();
-	if (idleLock == nullptr)
+
+	if (!mainBucket.empty())
 	{
-		return WorkerPool::JobLockPair(nullptr, nullptr);
+		mainThreadJobs.SubmitJobs(mainBucket.data(), mainBucket.size());
+		mainBucket.clear();
 	}
 
-	std::unique_lock<std::mutex> lock1(pullJobMutex, std::defer_lock);
-	std::shared_lock<std::shared_mutex> lock2(workersMutex, std::defer_lock);
-	std::lock(lock1, lock2);
+	WakeUpThreads(runnable);
 
-	if (workers[pullPool] != nullptr && !workers[pullPool]->JobPoolNoRunnableJobs())
+	if (!blocking.empty())
 	{
-		auto ret = workers[pullPool]->PullJob();
+		lock.unlock();
+		JobsSubmitted(blocking.size());
+		for (auto& job : blocking)
+		{
+			blockingWorkers->Submit(std::move(job));
+		}
+	}
 
-		++pullPool;
-		return WorkerPool::JobLockPair(std::move(ret), std::move(idleLock));
+	return true;
+}
+
+std::unique_ptr<CAM::Jobs::Job> CAM::Jobs::WorkerPool::TryPullingJob(bool background, JobPool& into, JobPriority atLeast)
+{
+	if (shutingDown.load(std::memory_order_acquire))
+	{
+		return nullptr;
+	}
+
+	if (!background && atLeast == JobPriority::Background && !mainThreadJobs.NoRunnableJobs())
+	{
+		auto ret = mainThreadJobs.PullJob();
+		if (ret != nullptr)
+		{
+			return ret;
+		}
+	}
+
+	int pullPool = FindPullablePool(atLeast);
+	if (pullPool == -1)
+	{
+		return nullptr;
+	}
+
+	auto victim = stealable[pullPool];
+	if (victim->JobPoolHasRunnableJobs(atLeast))
+	{
+		return victim->StealJob(into, atLeast);
 	}
 
-	return WorkerPool::JobLockPair(nullptr, nullptr);
+	return nullptr;
 }
 
-int CAM::Jobs::WorkerPool::FindPullablePool() const
+int CAM::Jobs::WorkerPool::FindPullablePool(JobPriority atLeast) const
 {
 	if (shutingDown.load(std::memory_order_acquire)) { return -1; }
-	auto lock = WorkersLock();
-	auto pullPool = ranGen(0, workers.size() - 1);
+	size_t count = stealableCount.load(std::memory_order_acquire);
+	if (count == 0) { return -1; }
+
+	auto thief = Worker::Current();
+	if (thief != nullptr && !thief->Victims().empty())
+	{
+		for (auto victim : thief->Victims())
+		{
+			if (victim < count && stealable[victim]->JobPoolHasRunnableJobs(atLeast))
+			{
+				return victim;
+			}
+		}
+		return -1;
+	}
+
+	auto pullPool = ranGen(0, count - 1);
 	bool first = true;
 	while (true)
 	{
-		if (pullPool >= workers.size())
+		if (pullPool >= count)
 		{
 			if (!first)
 			{
@@ -178,7 +448,7 @@ int CAM::Jobs::WorkerPool::FindPullablePool() const
 			pullPool = 0;
 			first = false;
 		}
-		if (workers[pullPool] != nullptr && !workers[pullPool]->JobPoolNoRunnableJobs())
+		if (stealable[pullPool]->JobPoolHasRunnableJobs(atLeast))
 		{
 			return pullPool;
 		}
@@ -190,6 +460,32 @@ void CAM::Jobs::WorkerPool::StartWorkers()
 {
 	if (shutingDown.load(std::memory_order_acquire)) { return; }
 	auto lock = WorkersLock();
+
+	// Everyone steals from the workers sharing their caches first. Ties go
+	// round-robin from our own index, so not everyone picks the same victim.
+	auto& topology = Utils::CpuTopology::Get();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		std::vector<size_t> victims;
+		for (size_t j = 1; j < workers.size(); ++j)
+		{
+			victims.push_back((i + j) % workers.size());
+		}
+
+		std::stable_sort
+		(
+			std::begin(victims),
+			std::end(victims),
+			[this, &topology, i] (size_t a, size_t b)
+			{
+				return topology.Distance(workers[i]->Cpu(), workers[a]->Cpu())
+					< topology.Distance(workers[i]->Cpu(), workers[b]->Cpu());
+			}
+		);
+
+		workers[i]->SetVictims(std::move(victims));
+	}
+
 	for (auto& worker: workers)
 	{
 		worker->StartThread();
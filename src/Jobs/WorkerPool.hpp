@@ -27,36 +27,43 @@
  * however the submit will not work if you have no workers. The PullJob might
  * return nullptr if no job can be found.
  *
- * This class is also where you should get jobs from. DO NOT ALLOCATE THEM
- * YOURSELF, that would be awfully inefficient. Workers will return jobs to
- * this class when they use them. If you request a job and then do not submit it
- * then it is your responsibility to return it.
+ * This class is also where you should get jobs from. Their memory comes from a
+ * slab which this class fills up front, see Job::operator new. Workers will
+ * return jobs to it when they use them. If you request a job and then do not
+ * submit it, just drop it.
  */
 
 #ifndef CAM_JOBS_THREADPOOL_HPP
 #define CAM_JOBS_THREADPOOL_HPP
 
 #include <vector>
+#include <array>
 #include <atomic>
 #include <cstdint>
 #include <mutex>
+#include <shared_mutex>
 
-#include "../Utils/CountedSharedMutex.hpp"
 #include "Worker.hpp"
+#include "Job.hpp"
+#include "BlockingWorkers.hpp"
 #include "../Utils/ThreadSafeRandomNumberGenerator.tpp"
-#include "../Utils/Allocator.tpp"
+#include "../Utils/Assert.hpp"
+#include "../Utils/Unused.hpp"
+#include "../Utils/Epoch.hpp"
+#include "../Config.hpp"
 
 namespace CAM
 {
 namespace Jobs
 {
 class Job;
+class ScheduleAwaitable;
+class AsyncIO;
 
 class WorkerPool
 {
 	public:
-	using JobLockPair = std::pair<std::unique_ptr<Job>, std::unique_ptr<std::shared_lock<CAM::Utils::CountedSharedMutex>>>;
-	WorkerPool() : mainThreadJobs(this) {}
+	WorkerPool();
 	~WorkerPool(); // Jobs' jobs arn't returned to the thread pool because its dieing anyways.
 
 	void AddWorker(std::unique_ptr<Worker> worker);
@@ -67,74 +74,98 @@ class WorkerPool
 	WorkerPool& operator=(WorkerPool&&)& = delete;
 
 	[[nodiscard]] bool SubmitJob(std::unique_ptr<Job> job); // false for failure
-	[[nodiscard]] JobLockPair TryPullingJob(bool background);
+
+	// Like calling SubmitJob on each, but every pool is locked at most once
+	// and we wake at most one sleeping worker per runnable job, in one pass.
+	// The jobs are moved out of batch.
+	[[nodiscard]] bool SubmitJobs(std::unique_ptr<Job>* batch, size_t count); // false for failure
+	[[nodiscard]] inline bool SubmitJobs(std::vector<std::unique_ptr<Job>>& batch)
+	{
+		return SubmitJobs(batch.data(), batch.size());
+	}
+	[[nodiscard]] std::unique_ptr<Job> TryPullingJob(bool background, JobPool& into, JobPriority atLeast = JobPriority::Background);
+
+	// co_await-able from a Task, see Task.hpp (which you must include).
+	[[nodiscard]] ScheduleAwaitable Schedule(JobD::JobFunc func, bool mainThreadOnly = false);
+
+	// Returns an unsubmitted job which calls fn(chunkBegin, chunkEnd) over
+	// [begin, end), in parallel and in chunks of at least grain items. Things
+	// depending on the returned job wait for the whole loop. To make a running
+	// job's dependents wait on it, call SameThingsDependOnMeAs(thisJob) on it
+	// before submitting. See ParallelFor.tpp.
+	template<typename Fn>
+	[[nodiscard]] std::unique_ptr<Job> ParallelFor(size_t begin, size_t end, size_t grain, Fn fn);
+
+	// Like ParallelFor, but each chunk's map(chunkBegin, chunkEnd) is combined
+	// into *result with reduce, which must be associative and commutative.
+	// *result is set to identity now and only holds the answer once the
+	// returned job's dependents run.
+	template<typename T, typename Map, typename Reduce>
+	[[nodiscard]] std::unique_ptr<Job> ParallelReduce(size_t begin, size_t end, size_t grain, T* result, T identity, Map map, Reduce reduce);
 
 	void StartWorkers();
 
-	[[nodiscard]] inline bool NoJobs() const
+	// Starts threadCount threads for blocking jobs, which take at most
+	// queueCapacity jobs at once, see BlockingWorkers. Without them blocking
+	// jobs are run by the Workers like any other job.
+	void StartBlockingWorkers(size_t threadCount, size_t queueCapacity);
+
+	[[nodiscard]] inline bool HasBlockingWorkers() const { return blockingWorkers != nullptr; }
+
+	// Starts AsyncIO with threadCount rings of queueDepth entries each, and
+	// bufferCount registered buffers of bufferSize bytes.
+	void StartAsyncIO(size_t threadCount, size_t queueDepth, size_t bufferCount, size_t bufferSize);
+
+	// nullptr till StartAsyncIO.
+	[[nodiscard]] inline AsyncIO* IO() { return asyncIO.get(); }
+
+	// Called by JobPool for runnable jobs with Blocking set, which never
+	// waits for room. Returns false if we have no BlockingWorkers, in which
+	// case job is left alone.
+	[[nodiscard]] inline bool QueueBlockingJob(std::unique_ptr<Job>& job)
 	{
-		size_t i = 0;
-		auto lock = WorkersLock();
-		while(i != workers.size())
+		if (blockingWorkers == nullptr)
 		{
-			if (!lock) { return false; }
-
-			if
-			(
-				inFlightMutex.SharedLockersLeft() != 0
-				|| !workers[i]->JobPoolNoRunnableJobs()
-				|| !mainThreadJobs.NoRunnableJobs())
-			{
-				return false;
-			}
-
-			++i;
+			return false;
 		}
 
+		blockingWorkers->Push(std::move(job));
 		return true;
 	}
 
-	[[nodiscard]] std::unique_ptr<std::shared_lock<std::shared_mutex>> WorkersLock() const
+	// Whether every submitted job has finished. Jobs which are queued,
+	// parked on their dependencies (including JobCounters signaled from
+	// outside the job system), running or suspended in a fiber all count.
+	[[nodiscard]] inline bool NoJobs() const
 	{
-		auto ret = std::make_unique<std::shared_lock<std::shared_mutex>>(workersMutex, std::defer_lock);
-		if (ret->try_lock())
-		{
-			return ret;
-		}
-
-		return nullptr;
+		return outstandingJobs.load(std::memory_order_acquire) == 0;
 	}
 
-	[[nodiscard]] std::unique_ptr<std::shared_lock<CAM::Utils::CountedSharedMutex>> InFlightLock() const
+	// Called by JobPool as jobs are submitted, and by Worker as they finish.
+	inline void JobsSubmitted(size_t n) { outstandingJobs.fetch_add(n, std::memory_order_acq_rel); }
+	inline void JobFinished()
 	{
-		if (shutingDown.load(std::memory_order_acquire))
-		{
-			return nullptr;
-		}
-
-		auto ret = std::make_unique<std::shared_lock<CAM::Utils::CountedSharedMutex>>(inFlightMutex, std::defer_lock);
-		if (ret->try_lock())
-		{
-			return ret;
-		}
-
-		return nullptr;
+		MAYBE_UNUSED size_t val = outstandingJobs.fetch_sub(1, std::memory_order_acq_rel);
+		ASSERT(val != 0, "More jobs finished than were submitted.");
 	}
 
-	[[nodiscard]] inline CAM::Utils::CountedSharedMutex& GetInflightMutex() const
+	// Check the returned lock, it may not own the mutex.
+	[[nodiscard]] std::shared_lock<std::shared_mutex> WorkersLock() const
 	{
-		return inFlightMutex;
+		return std::shared_lock<std::shared_mutex>(workersMutex, std::try_to_lock);
 	}
 
 	template<typename... Args>
 	[[nodiscard]] inline std::unique_ptr<Job> GetJob(Args&&... args)
 	{
-		return jobAllocator(std::forward<Args>(args)...);
+		return std::make_unique<Job>(std::forward<Args>(args)...);
 	}
 
+	// Other threads may still be touching it, so it only goes back to the
+	// slab once they've all moved on, see Utils::Epoch.
 	inline void ReturnJob(std::unique_ptr<Job> job)
 	{
-		jobAllocator.Return(std::move(job));
+		Utils::Epoch::Retire(job.release());
 	}
 
 	[[nodiscard]] inline JobPool& MainThreadJobs()
@@ -142,23 +173,85 @@ class WorkerPool
 		return mainThreadJobs;
 	}
 
-	void WakeUpThreads(size_t number);
+	// Wakes up to number sleeping workers, preferring preferred and then the
+	// ones closest to us. Workers which are awake are left alone.
+	void WakeUpThreads(size_t number, int preferred = -1);
+
+	// Called by workers around parking.
+	inline void MarkIdle(size_t worker)
+	{
+		idleWorkers[worker / 64].fetch_or(uint64_t(1) << (worker % 64), std::memory_order_seq_cst);
+	}
+	inline void MarkBusy(size_t worker)
+	{
+		idleWorkers[worker / 64].fetch_and(~(uint64_t(1) << (worker % 64)), std::memory_order_relaxed);
+	}
+	[[nodiscard]] inline bool IsIdle(size_t worker) const
+	{
+		return (idleWorkers[worker / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (worker % 64))) != 0;
+	}
+
+	// How many times we woke a worker, and how many of those times it found
+	// nothing to do before parking again.
+	[[nodiscard]] inline size_t Wakeups() const { return wakeups.load(std::memory_order_relaxed); }
+	[[nodiscard]] inline size_t EmptyWakeups() const { return emptyWakeups.load(std::memory_order_relaxed); }
+	inline void CountEmptyWakeup() { emptyWakeups.fetch_add(1, std::memory_order_relaxed); }
+
+	// Whether any worker has jobs which could be stolen.
+	[[nodiscard]] inline bool AnyRunnableJobs() const
+	{
+		return FindPullablePool(JobPriority::Background) != -1;
+	}
+
+	// How many frame-critical jobs are waiting in the workers' pools, so
+	// workers know to go steal them before running their own lesser jobs.
+	[[nodiscard]] inline size_t FrameCriticalJobsQueued() const
+	{
+		return frameCriticalJobsQueued.load(std::memory_order_relaxed);
+	}
+	inline void FrameCriticalJobQueued() { frameCriticalJobsQueued.fetch_add(1, std::memory_order_relaxed); }
+	inline void FrameCriticalJobTaken() { frameCriticalJobsQueued.fetch_sub(1, std::memory_order_relaxed); }
+
+	static constexpr size_t maxWorkers = 256;
 
 	private:
-	int FindPullablePool() const;
+	int FindPullablePool(JobPriority atLeast) const;
+	[[nodiscard]] bool WakeUpIfIdle(size_t worker);
+
+	template<typename State>
+	[[nodiscard]] std::unique_ptr<Job> ParallelForJob(std::shared_ptr<State> state, size_t begin, size_t end);
+	template<typename State>
+	[[nodiscard]] std::unique_ptr<Job> ParallelReduceJob(std::shared_ptr<State> state, size_t begin, size_t end);
+	template<typename MakeJob, typename Body>
+	void SplitRange(size_t begin, size_t end, size_t grain, Job* thisJob, MakeJob&& makeJob, Body&& body);
 
-	Utils::Allocator<Job> jobAllocator;
 	mutable Utils::ThreadSafeRandomNumberGenerator<size_t> ranGen;
-	mutable std::mutex pullJobMutex;
-	mutable CAM::Utils::CountedSharedMutex inFlightMutex;
 	mutable std::shared_mutex workersMutex;
 	std::vector<std::unique_ptr<Worker>> workers;
 
+	// The same workers, for stealing without taking workersMutex. Slots are
+	// only ever appended to, and we only take them back once every worker's
+	// thread has exited, so anything under stealableCount stays valid.
+	std::array<Worker*, maxWorkers> stealable = {};
+	std::atomic<size_t> stealableCount = 0;
+
 	JobPool mainThreadJobs;
+	std::unique_ptr<BlockingWorkers> blockingWorkers;
+	std::unique_ptr<AsyncIO> asyncIO;
 
+	alignas(64) std::atomic<size_t> frameCriticalJobsQueued = 0;
+	alignas(64) std::atomic<size_t> outstandingJobs = 0;
+
+	// One bit per worker, set while it is parked or about to be.
+	alignas(64) std::array<std::atomic<uint64_t>, maxWorkers / 64> idleWorkers = {};
+	alignas(64) std::atomic<size_t> nextSubmitPool = 0;
+	alignas(64) std::atomic<size_t> wakeups = 0;
+	std::atomic<size_t> emptyWakeups = 0;
 	std::atomic<bool> shutingDown = false;
 };
 }
 }
 
+#include "ParallelFor.tpp"
+
 #endif
@@ -19,21 +19,27 @@
 
 #include "Main.hpp"
 #include "Utils/VersionNumber.hpp"
+#include "Utils/CpuTopology.hpp"
+#include "Utils/Profiler.hpp"
 
 void CAM::Main::Start()
 {
 	printf("!!!!Welcome to CAM-RE version %s (#%u)!!!!\n\n", Version::ver.c_str(), Version::commitNumber);
 
-	auto myWorkerUni = std::make_unique<CAM::Jobs::Worker>(&wp, false);
+	auto cpus = Utils::CpuTopology::Get().WorkerCpus(Config::ThreadCount);
+
+	auto myWorkerUni = std::make_unique<CAM::Jobs::Worker>(&wp, false, cpus[0]);
 	auto myWorker = myWorkerUni.get();
 	wp.AddWorker(std::move(myWorkerUni));
 
-	for (size_t i = 0; i < Config::ThreadCount - 1; ++i)
+	for (size_t i = 1; i < cpus.size(); ++i)
 	{
-		wp.AddWorker(std::make_unique<CAM::Jobs::Worker>(&wp, true));
+		wp.AddWorker(std::make_unique<CAM::Jobs::Worker>(&wp, true, cpus[i]));
 	}
 
 	wp.StartWorkers();
+	wp.StartBlockingWorkers(Config::BlockingThreadCount, Config::BlockingQueueCapacity);
+	wp.StartAsyncIO(Config::IOThreadCount, Config::IOQueueDepth, Config::IOBufferCount, Config::IOBufferSize);
 
 	/*
 	 * [Init] -> [FrameStart] -> [Done]
@@ -90,7 +96,7 @@ void CAM::Main::Init
 	CAM::Jobs::Job* thisJob
 )
 {
-	renderer = std::make_unique<Renderer::Renderer>(&wp, thisJob);
+	renderer = std::make_unique<Renderer::Renderer>(&wp, thisJob, &frameArena);
 }
 
 void CAM::Main::FrameStart
@@ -104,11 +110,16 @@ void CAM::Main::FrameStart
 	 * [renderer->DoFrame] -> [FrameStart] -> *
 	 */
 
+	CAM_PROFILE_SCOPE("FrameStart");
+
 	if (!renderer->ShouldContinue())
 	{
 		return;
 	}
 
+	// The last frame's jobs are all done, as we depend on them.
+	frameArena.BeginFrame(frame++);
+
 	using namespace std::placeholders;
 	auto fsJob = wp.GetJob
 	(
@@ -121,7 +132,8 @@ void CAM::Main::FrameStart
 	(
 		std::bind(&Renderer::Renderer::DoFrame, renderer.get(), _1, _2, _3),
 		1,
-		false
+		false,
+		Jobs::JobPriority::FrameCritical
 	);
 
 	fsJob->DependsOn(dfJob.get());
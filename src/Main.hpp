@@ -25,8 +25,10 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 
 #include "Renderer/Renderer.hpp"
+#include "Utils/FrameArena.hpp"
 
 #include "Config.hpp"
 
@@ -68,6 +70,9 @@ class Main
 
 	private:
 	Jobs::WorkerPool wp;
+	Utils::FrameArena frameArena{Config::FramesInFlight, Config::FrameArenaBlockSize};
+	uint64_t frame = 0;
+
 	std::unique_ptr<Renderer::Renderer> renderer;
 };
 }
@@ -18,13 +18,17 @@
  */
 
 #include "Renderer.hpp"
+#include "../Utils/Profiler.hpp"
 
 CAM::Renderer::Renderer::Renderer
 (
 	Jobs::WorkerPool* wp,
-	Jobs::Job* thisJob
-) : wp(wp)
+	Jobs::Job* thisJob,
+	Utils::FrameArena* frameArena
+) : frameArena(frameArena), wp(wp)
 {
+	RecordFrameGraph();
+
 	/*
 	 * [[M]SDLWindow Lambda] --\     [[M]VKSurface Lambda] -V
 	 * [InitGlobalFuncs Lambda] => [VKInstance Lambda] -^ [VKDevice Lambda] -\
@@ -132,35 +136,45 @@ void CAM::Renderer::Renderer::DoFrame
 	size_t /*thread*/,
 	Jobs::Job* thisJob
 )
+{
+	CAM_PROFILE_SCOPE("DoFrame");
+	frameGraph.Instantiate(wp, FrameParams{frameIndex++, frameArena}, thisJob, frameArena->Resource());
+}
+
+void CAM::Renderer::Renderer::RecordFrameGraph()
 {
 	/*
 	 * [[M]window->HandleEvents] -> [AcquireImage Lambda] -> [PresentImage] -> *
+	 *
+	 * AcquireImage and PresentImage push back their completion when they have
+	 * to retry, so they're extensible. AcquireImage also pushes it back till
+	 * the image's fence is signaled.
 	 */
 
-	using namespace std::placeholders;
-	auto sdlJob = wp->GetJob
+	auto sdlNode = frameGraph.AddNode
 	(
-		std::bind(&SDLWindow::HandleEvents, window.get(), _1, _2, _3),
-		0,
-		true // main thread only
+		[this] (Jobs::WorkerPool* wp, size_t thread, Jobs::Job* thisJob, const FrameParams&)
+		{
+			window->HandleEvents(wp, thread, thisJob);
+		},
+		true, // main thread only
+		Jobs::JobPriority::FrameCritical
 	);
 
-	auto aImJob = wp->GetJob
+	auto aImNode = frameGraph.AddNode
 	(
-		[this] (Jobs::WorkerPool*, size_t, Jobs::Job* thisJob)
+		[this] (Jobs::WorkerPool*, size_t, Jobs::Job* thisJob, const FrameParams&)
 		{
 			AcquireImage(thisJob);
 		},
-		0,
-		true // main thread only
+		true, // main thread only
+		Jobs::JobPriority::FrameCritical,
+		true // extensible
 	);
 
-	aImJob->DependsOn(sdlJob.get());
-	if (!wp->SubmitJob(std::move(sdlJob))) { throw std::runtime_error("Could not submit job\n"); }
-
-	auto pJob = wp->GetJob
+	auto pNode = frameGraph.AddNode
 	(
-		[this] (Jobs::WorkerPool*, size_t, Jobs::Job* thisJob)
+		[this] (Jobs::WorkerPool*, size_t, Jobs::Job* thisJob, const FrameParams&)
 		{
 			ASSERT
 			(
@@ -169,15 +183,13 @@ void CAM::Renderer::Renderer::DoFrame
 			);
 			vkSwapchain->PresentImage(thisJob, imgData.first, imgData.second);
 		},
-		0,
-		true // main thread only
+		true, // main thread only
+		Jobs::JobPriority::FrameCritical,
+		true // extensible
 	);
 
-	pJob->DependsOn(aImJob.get());
-	if (!wp->SubmitJob(std::move(aImJob))) { throw std::runtime_error("Could not submit job\n"); }
-
-	pJob->SameThingsDependOnMeAs(thisJob);
-	if (!wp->SubmitJob(std::move(pJob))) { throw std::runtime_error("Could not submit job\n"); }
+	frameGraph.AddEdge(sdlNode, aImNode);
+	frameGraph.AddEdge(aImNode, pNode);
 }
 
 bool CAM::Renderer::Renderer::ShouldContinue() { return window->ShouldContinue(); }
@@ -192,4 +204,27 @@ void CAM::Renderer::Renderer::AcquireImage(Jobs::Job* thisJob)
 			AcquireImage(thisJob);
 		}
 	);
+
+	if (imgData.first == nullptr)
+	{
+		return; // Retrying
+	}
+
+	// The image may not be ours yet, so hold presenting it back till its
+	// fence says it is, without a worker waiting on the GPU meanwhile.
+	auto acquired = imgData.first->imageAcquired.get();
+	acquired->Reset();
+
+	auto gate = wp->GetJob
+	(
+		[] (Jobs::WorkerPool*, size_t, Jobs::Job*) {},
+		0,
+		false,
+		Jobs::JobPriority::FrameCritical
+	);
+	gate->DependsOn(acquired);
+	gate->SameThingsDependOnMeAs(thisJob);
+	if (!wp->SubmitJob(std::move(gate))) { throw std::runtime_error("Could not submit job\n"); }
+
+	imgData.first->imageAcquiredFence->SignalWhenReady(acquired, Jobs::JobPriority::FrameCritical);
 }
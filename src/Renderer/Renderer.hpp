@@ -22,9 +22,11 @@
 
 #include "../Jobs/Job.hpp"
 #include "../Jobs/WorkerPool.hpp"
+#include "../Jobs/JobGraph.tpp"
 
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 
 #include "Vulkan.h"
 #include <SDL2/SDL.h>
@@ -38,6 +40,7 @@
 #include "VKSurface.hpp"
 #include "VKSwapchain.hpp"
 
+#include "../Utils/FrameArena.hpp"
 #include "../Config.hpp"
 
 namespace CAM
@@ -48,7 +51,7 @@ class Renderer
 {
 	public:
 
-	Renderer(Jobs::WorkerPool* wp, Jobs::Job* thisJob);
+	Renderer(Jobs::WorkerPool* wp, Jobs::Job* thisJob, Utils::FrameArena* frameArena);
 
 	void DoFrame
 	(
@@ -67,13 +70,25 @@ class Renderer
 
 	VKSwapchain::ImgData imgData;
 
+	struct FrameParams
+	{
+		uint64_t frameIndex;
+		Utils::FrameArena* arena; // For anything which dies with the frame
+	};
+
 	private:
+	void RecordFrameGraph();
+
+	Jobs::JobGraph<FrameParams> frameGraph;
+	uint64_t frameIndex = 0;
+	Utils::FrameArena* frameArena;
+
 	std::unique_ptr<SDLWindow> window;
 	std::unique_ptr<VKInstance> vkInstance;
 	std::unique_ptr<VKSurface> vkSurface;
 	std::unique_ptr<VKDevice> vkDevice;
 	std::unique_ptr<VKSwapchain> vkSwapchain;
-	CAM::Jobs::WorkerPool* UNUSED(wp);
+	CAM::Jobs::WorkerPool* wp;
 };
 }
 }
@@ -21,6 +21,7 @@
 #include "Renderer.hpp"
 #include "../Config.hpp"
 #include "../Utils/Assert.hpp"
+#include "../Utils/Profiler.hpp"
 
 CAM::Renderer::SDLWindow::SDLWindow
 (
@@ -64,6 +65,8 @@ void CAM::Renderer::SDLWindow::HandleEvents
 	CAM::Jobs::Job* /*thisJob*/
 )
 {
+	CAM_PROFILE_SCOPE("HandleEvents");
+
 	static auto a = 0;
 	const auto s = 300;
 
@@ -89,6 +92,24 @@ void CAM::Renderer::SDLWindow::HandleEvents
 		{
 			shouldContinue.store(false, std::memory_order_release);
 		}
+		else if
+		(
+			Utils::Profiler::Enabled
+			&& event.type == SDL_KEYDOWN
+			&& event.key.keysym.sym == SDLK_F12
+			&& event.key.repeat == 0
+		)
+		{
+			try
+			{
+				Utils::Profiler::WriteChromeTrace(Config::ProfilerTracePath);
+				printf("Wrote trace to %s\n", Config::ProfilerTracePath);
+			}
+			catch (const std::exception& e)
+			{
+				printf("%s\n", e.what());
+			}
+		}
 	}
 }
 
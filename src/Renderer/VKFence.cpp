@@ -20,6 +20,7 @@
 #include "Renderer.hpp"
 #include "VKFence.hpp"
 #include "VKDevice.hpp"
+#include "../Utils/Fiber.hpp"
 
 CAM::Renderer::VKFence::VKFence(Jobs::WorkerPool* wp, Jobs::Job* /*thisJob*/, Renderer* parent)
 	: wp(wp), parent(parent), device(parent->GetVKDevice())
@@ -65,3 +66,27 @@ bool CAM::Renderer::VKFence::WaitFor(uint64_t timeout)
 		timeout
 	)) == VK_SUCCESS;
 }
+
+void CAM::Renderer::VKFence::SignalWhenReady(Jobs::JobEvent* event, Jobs::JobPriority priority)
+{
+	auto job = wp->GetJob
+	(
+		[this, event] (Jobs::WorkerPool*, size_t, Jobs::Job*)
+		{
+			// On a BlockingWorker we just wait. If there are none our Worker
+			// polls the fence between other jobs, unless there are no fibers
+			// either, in which case we've no choice but to block.
+			if (!Utils::Fiber::YieldUntil([this] { return IsReady(); }))
+			{
+				WaitFor(UINT64_MAX);
+			}
+			event->Signal();
+		},
+		0,
+		false,
+		priority
+	);
+	job->SetBlocking();
+
+	if (!wp->SubmitJob(std::move(job))) { throw std::runtime_error("Could not submit job\n"); }
+}
@@ -22,6 +22,7 @@
 
 #include "../Jobs/Job.hpp"
 #include "../Jobs/WorkerPool.hpp"
+#include "../Jobs/JobCounter.hpp"
 
 #include <cstdint>
 #include <cstring>
@@ -64,8 +65,13 @@ class VKFence
 	void Reset();
 	bool WaitFor(uint64_t timeout); // False if timed out
 
+	// Signals event once the fence is ready, without blocking a worker while
+	// the GPU catches up. Give the priority of whatever waits on event, so
+	// polling the fence doesn't end up behind work it's holding up.
+	void SignalWhenReady(Jobs::JobEvent* event, Jobs::JobPriority priority);
+
 	private:
-	CAM::Jobs::WorkerPool* UNUSED(wp);
+	CAM::Jobs::WorkerPool* wp;
 
 	VkFence vkFence;
 	mutable std::mutex vkFenceMutex;
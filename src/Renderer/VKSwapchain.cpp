@@ -22,7 +22,6 @@
 #include "VKSwapchain.hpp"
 #include "VKQueue.hpp"
 #include "../Config.hpp"
-#include "../Utils/ConditionalContinue.hpp"
 
 CAM::Renderer::VKSwapchain::VKSwapchain(Jobs::WorkerPool* wp, Jobs::Job* thisJob, Renderer* parent)
 	: wp(wp),
@@ -233,7 +232,9 @@ void CAM::Renderer::VKSwapchain::RecreateSwapchain_Internal(uint32_t width, uint
 			swapImageSyncDatas.push_back
 			({
 				std::make_unique<VKSemaphore>(wp, thisJob, parent),
-				std::make_unique<VKSemaphore>(wp, thisJob, parent)
+				std::make_unique<VKSemaphore>(wp, thisJob, parent),
+				std::make_unique<VKFence>(wp, thisJob, parent),
+				std::make_unique<Jobs::JobEvent>()
 			});
 			++index;
 		}
@@ -348,9 +349,15 @@ CAM::Renderer::VKSwapchain::ImgData CAM::Renderer::VKSwapchain::AcquireImage(Job
 			std::memory_order_relaxed
 		)) {}
 
+		// Last signaled by this sync data's previous acquire, whose frame is
+		// long done.
+		auto& syncData = swapImageSyncDatas[thisSync];
+		syncData.imageAcquiredFence->Reset();
+
 		uint32_t index;
-		auto sem = (*swapImageSyncDatas[thisSync].imageAvailableSemaphore)();
-		sem.first.lock();
+		auto sem = (*syncData.imageAvailableSemaphore)();
+		auto fence = (*syncData.imageAcquiredFence)();
+		std::lock(sem.first, fence.first);
 
 		while (true)
 		{
@@ -362,7 +369,7 @@ CAM::Renderer::VKSwapchain::ImgData CAM::Renderer::VKSwapchain::AcquireImage(Job
 					vkSwapchain,
 					std::numeric_limits<uint32_t>::max(),
 					sem.second,
-					VK_NULL_HANDLE,
+					fence.second,
 					&index
 				);
 
@@ -374,7 +381,7 @@ CAM::Renderer::VKSwapchain::ImgData CAM::Renderer::VKSwapchain::AcquireImage(Job
 
 				if (res == VK_SUCCESS)
 				{
-					return {&swapImageSyncDatas[thisSync], &swapImageDatas[index]};
+					return {&syncData, &swapImageDatas[index]};
 				}
 			}
 			break;
@@ -68,13 +68,22 @@ struct SwapImageSyncData
 	SwapImageSyncData
 	(
 		std::unique_ptr<VKSemaphore>&& imageAvailableSemaphore,
-		std::unique_ptr<VKSemaphore>&& presentCompleteSemaphore
+		std::unique_ptr<VKSemaphore>&& presentCompleteSemaphore,
+		std::unique_ptr<VKFence>&& imageAcquiredFence,
+		std::unique_ptr<Jobs::JobEvent>&& imageAcquired
 	) : imageAvailableSemaphore(std::move(imageAvailableSemaphore)),
-		presentCompleteSemaphore(std::move(presentCompleteSemaphore))
+		presentCompleteSemaphore(std::move(presentCompleteSemaphore)),
+		imageAcquiredFence(std::move(imageAcquiredFence)),
+		imageAcquired(std::move(imageAcquired))
 	{}
 
 	std::unique_ptr<VKSemaphore> imageAvailableSemaphore;
 	std::unique_ptr<VKSemaphore> presentCompleteSemaphore;
+
+	// Signaled by AcquireImage once the image really is ours, see
+	// VKFence::SignalWhenReady.
+	std::unique_ptr<VKFence> imageAcquiredFence;
+	std::unique_ptr<Jobs::JobEvent> imageAcquired;
 };
 
 class VKSwapchain
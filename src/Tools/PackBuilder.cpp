@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAMPack, which packs every file under a directory into one pack. Files are
+ * named by their path relative to that directory, with forward slashes.
+ *
+ *	CAMPack [--store] <pack> <directory>
+ *
+ * --store skips compressing them.
+ */
+
+#include "../Utils/Pack.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+int main(int argc, char** argv)
+{
+	bool compress = true;
+	int arg = 1;
+	if (arg < argc && std::strcmp(argv[arg], "--store") == 0)
+	{
+		compress = false;
+		++arg;
+	}
+
+	if (argc - arg != 2)
+	{
+		fprintf(stderr, "Usage: %s [--store] <pack> <directory>\n", argv[0]);
+		return 1;
+	}
+
+	std::filesystem::path packPath = argv[arg];
+	std::filesystem::path root = argv[arg + 1];
+
+	try
+	{
+		CAM::Utils::PackWriter writer;
+		size_t files = 0;
+		size_t bytes = 0;
+
+		for (auto& item : std::filesystem::recursive_directory_iterator(root))
+		{
+			if (!item.is_regular_file())
+			{
+				continue;
+			}
+
+			std::ifstream in(item.path(), std::ios::binary);
+			std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			if (!in.good() && !in.eof())
+			{
+				throw std::runtime_error("Failed to read " + item.path().string());
+			}
+
+			std::vector<std::byte> data(contents.size());
+			std::memcpy(data.data(), contents.data(), contents.size());
+
+			writer.Add(item.path().lexically_relative(root).generic_string(), std::move(data), compress);
+			++files;
+			bytes += contents.size();
+		}
+
+		writer.Write(packPath.string());
+		printf
+		(
+			"Packed %zu files, %zu bytes, into %s (%ju bytes).\n",
+			files,
+			bytes,
+			packPath.string().c_str(),
+			static_cast<uintmax_t>(std::filesystem::file_size(packPath))
+		);
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
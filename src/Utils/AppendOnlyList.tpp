@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A list of T*s which any thread can append to without locking.
+ *
+ * The first InlineSize items are stored inline, the rest go into chunks of
+ * ChunkSize items. Chunks are never freed till the list dies, so a recycled
+ * list which overflowed once won't allocate again.
+ *
+ * ForEach may run alongside appends, it will visit at least the items appended
+ * before it started. Clear may not run alongside anything.
+ */
+
+#ifndef CAM_UTILS_APPENDONLYLIST_TPP
+#define CAM_UTILS_APPENDONLYLIST_TPP
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+
+namespace CAM
+{
+namespace Utils
+{
+template<typename T, size_t InlineSize, size_t ChunkSize>
+class AppendOnlyList
+{
+	private:
+	struct Chunk
+	{
+		Chunk()
+		{
+			for (auto& item : items)
+			{
+				item.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+
+		std::array<std::atomic<T*>, ChunkSize> items;
+		std::atomic<Chunk*> next = nullptr;
+	};
+
+	public:
+	AppendOnlyList()
+	{
+		for (auto& item : items)
+		{
+			item.store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	~AppendOnlyList()
+	{
+		Chunk* chunk = overflow.load(std::memory_order_acquire);
+		while (chunk != nullptr)
+		{
+			Chunk* next = chunk->next.load(std::memory_order_relaxed);
+			delete chunk;
+			chunk = next;
+		}
+	}
+
+	AppendOnlyList(const AppendOnlyList&) = delete;
+	AppendOnlyList(AppendOnlyList&&) = delete;
+	AppendOnlyList& operator=(const AppendOnlyList&)& = delete;
+	AppendOnlyList& operator=(AppendOnlyList&&)& = delete;
+
+	inline void Append(T* item)
+	{
+		size_t index = count.fetch_add(1, std::memory_order_acq_rel);
+		Slot(index)->store(item, std::memory_order_release);
+	}
+
+	template<typename F>
+	inline void ForEach(F&& f) const
+	{
+		size_t size = count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < size; ++i)
+		{
+			auto slot = Slot(i);
+
+			// The appender might've grabbed the index but not stored yet.
+			T* item;
+			while ((item = slot->load(std::memory_order_acquire)) == nullptr) {}
+
+			f(item);
+		}
+	}
+
+	// Makes sure the first size items won't need to allocate.
+	inline void Reserve(size_t size)
+	{
+		if (size > InlineSize)
+		{
+			Slot(size - 1);
+		}
+	}
+
+	inline void Clear()
+	{
+		size_t size = count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < size; ++i)
+		{
+			Slot(i)->store(nullptr, std::memory_order_relaxed);
+		}
+		count.store(0, std::memory_order_release);
+	}
+
+	[[nodiscard]] inline size_t Size() const { return count.load(std::memory_order_acquire); }
+
+	private:
+	// Readers may get here before the appender which grabbed the index, so
+	// everyone is allowed to create the chunk.
+	inline std::atomic<T*>* Slot(size_t index) const
+	{
+		if (index < InlineSize)
+		{
+			return &items[index];
+		}
+
+		index -= InlineSize;
+		std::atomic<Chunk*>* link = &overflow;
+		while (true)
+		{
+			Chunk* chunk = link->load(std::memory_order_acquire);
+			if (chunk == nullptr)
+			{
+				auto newChunk = new Chunk();
+				if (link->compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel, std::memory_order_acquire))
+				{
+					chunk = newChunk;
+				}
+				else
+				{
+					// Someone beat us to it
+					delete newChunk;
+				}
+			}
+
+			if (index < ChunkSize)
+			{
+				return &chunk->items[index];
+			}
+
+			index -= ChunkSize;
+			link = &chunk->next;
+		}
+	}
+
+	mutable std::array<std::atomic<T*>, InlineSize> items;
+	std::atomic<size_t> count = 0;
+	mutable std::atomic<Chunk*> overflow = nullptr;
+};
+}
+}
+
+#endif
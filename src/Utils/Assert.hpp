@@ -21,8 +21,11 @@
 #define CAM_UTILS_ASSERT_HPP
 
 #include <string>
+#include <stdexcept>
 
-#define ASSERT(x, y) CAM::Utils::Assert(x, "Condition `" #x "` failed at \"" __FILE__ ":" + std::to_string(__LINE__) + "\": " + y)
+// The message is only built if the condition fails, so passing asserts never
+// allocate.
+#define ASSERT(x, y) ((x) ? (void)0 : CAM::Utils::Assert(false, "Condition `" #x "` failed at \"" __FILE__ ":" + std::to_string(__LINE__) + "\": " + y))
 
 namespace CAM
 {
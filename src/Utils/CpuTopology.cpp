@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CpuTopology.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <tuple>
+#include <thread>
+#include <cerrno>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+const std::string cpuRoot = "/sys/devices/system/cpu/";
+}
+
+const CAM::Utils::CpuTopology& CAM::Utils::CpuTopology::Get()
+{
+	static CpuTopology topology;
+	return topology;
+}
+
+CAM::Utils::CpuTopology::CpuTopology()
+{
+	auto allowed = AllowedCpus();
+	allowedCount = allowed.empty() ? std::max<size_t>(std::thread::hardware_concurrency(), 1) : allowed.size();
+
+	std::string online;
+	if (!ReadLine(cpuRoot + "online", online))
+	{
+		return;
+	}
+
+	for (auto id : ParseList(online))
+	{
+		if (!allowed.empty() && !std::binary_search(std::begin(allowed), std::end(allowed), id))
+		{
+			continue;
+		}
+
+		auto dir = cpuRoot + "cpu" + std::to_string(id) + "/";
+
+		Cpu cpu;
+		cpu.id = id;
+		cpu.package = ReadInt(dir + "topology/physical_package_id", 0);
+		cpu.core = ReadInt(dir + "topology/core_id", id);
+		cpu.l2 = -1;
+		cpu.l3 = -1;
+
+		for (size_t index = 0; ; ++index)
+		{
+			auto cacheDir = dir + "cache/index" + std::to_string(index) + "/";
+
+			int level = ReadInt(cacheDir + "level", -1);
+			if (level == -1)
+			{
+				break;
+			}
+
+			std::string type;
+			std::string shared;
+			if
+			(
+				!ReadLine(cacheDir + "type", type)
+				|| type == "Instruction"
+				|| !ReadLine(cacheDir + "shared_cpu_list", shared)
+			)
+			{
+				continue;
+			}
+
+			auto sharers = ParseList(shared);
+			if (sharers.empty())
+			{
+				continue;
+			}
+
+			int group = *std::min_element(std::begin(sharers), std::end(sharers));
+			if (level == 2) { cpu.l2 = group; }
+			else if (level == 3) { cpu.l3 = group; }
+		}
+
+		cpus.push_back(cpu);
+	}
+
+	// Take the first SMT sibling of each core, then put cores sharing caches
+	// next to each other.
+	std::vector<Cpu> cores;
+	for (auto& cpu : cpus)
+	{
+		bool seen = std::any_of
+		(
+			std::begin(cores),
+			std::end(cores),
+			[&cpu] (const Cpu& core) { return core.package == cpu.package && core.core == cpu.core; }
+		);
+
+		if (!seen)
+		{
+			cores.push_back(cpu);
+		}
+	}
+
+	std::sort
+	(
+		std::begin(cores),
+		std::end(cores),
+		[] (const Cpu& a, const Cpu& b)
+		{
+			return std::tie(a.package, a.l3, a.l2, a.id) < std::tie(b.package, b.l3, b.l2, b.id);
+		}
+	);
+
+	for (auto& core : cores)
+	{
+		physicalCores.push_back(core.id);
+	}
+}
+
+std::vector<int> CAM::Utils::CpuTopology::WorkerCpus(size_t count) const
+{
+	if (physicalCores.empty())
+	{
+		if (count == 0)
+		{
+			count = allowedCount;
+		}
+		return std::vector<int>(count, -1);
+	}
+
+	if (count == 0)
+	{
+		count = physicalCores.size();
+	}
+
+	// Cores first, then their siblings, then round again.
+	std::vector<int> order = physicalCores;
+	for (auto core : physicalCores)
+	{
+		auto coreCpu = Find(core);
+		for (auto& cpu : cpus)
+		{
+			if (cpu.id != core && cpu.package == coreCpu->package && cpu.core == coreCpu->core)
+			{
+				order.push_back(cpu.id);
+			}
+		}
+	}
+
+	std::vector<int> ret;
+	ret.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		ret.push_back(order[i % order.size()]);
+	}
+
+	return ret;
+}
+
+size_t CAM::Utils::CpuTopology::Distance(int a, int b) const
+{
+	auto ca = Find(a);
+	auto cb = Find(b);
+	if (ca == nullptr || cb == nullptr) { return 4; }
+
+	if (ca->package == cb->package && ca->core == cb->core) { return 0; }
+	if (ca->l2 != -1 && ca->l2 == cb->l2) { return 1; }
+	if (ca->l3 != -1 && ca->l3 == cb->l3) { return 2; }
+	if (ca->package == cb->package) { return 3; }
+	return 4;
+}
+
+bool CAM::Utils::CpuTopology::PinThisThread(int cpu)
+{
+	if (cpu < 0)
+	{
+		return true;
+	}
+
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+// Sorted. The mask's size isn't known up front, so grow it till the kernel's
+// fits.
+std::vector<int> CAM::Utils::CpuTopology::AllowedCpus()
+{
+	std::vector<int> ret;
+
+#ifdef __linux__
+	for (int maxCpus = 1024; maxCpus <= 1 << 16; maxCpus *= 2)
+	{
+		cpu_set_t* set = CPU_ALLOC(maxCpus);
+		if (set == nullptr)
+		{
+			break;
+		}
+
+		size_t size = CPU_ALLOC_SIZE(maxCpus);
+		CPU_ZERO_S(size, set);
+		if (sched_getaffinity(0, size, set) == 0)
+		{
+			for (int cpu = 0; cpu < maxCpus; ++cpu)
+			{
+				if (CPU_ISSET_S(cpu, size, set))
+				{
+					ret.push_back(cpu);
+				}
+			}
+			CPU_FREE(set);
+			break;
+		}
+
+		int error = errno;
+		CPU_FREE(set);
+		if (error != EINVAL)
+		{
+			break;
+		}
+	}
+#endif
+
+	return ret;
+}
+
+const CAM::Utils::CpuTopology::Cpu* CAM::Utils::CpuTopology::Find(int id) const
+{
+	for (auto& cpu : cpus)
+	{
+		if (cpu.id == id)
+		{
+			return &cpu;
+		}
+	}
+	return nullptr;
+}
+
+// Lists look like "0-3,8,10-11"
+std::vector<int> CAM::Utils::CpuTopology::ParseList(const std::string& list)
+{
+	std::vector<int> ret;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ','))
+	{
+		if (range.empty())
+		{
+			continue;
+		}
+
+		try
+		{
+			auto dash = range.find('-');
+			int first = std::stoi(range.substr(0, dash));
+			int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int i = first; i <= last; ++i)
+			{
+				ret.push_back(i);
+			}
+		}
+		catch (const std::exception&)
+		{
+			return {};
+		}
+	}
+	return ret;
+}
+
+bool CAM::Utils::CpuTopology::ReadLine(const std::string& path, std::string& line)
+{
+	std::ifstream file(path);
+	return static_cast<bool>(std::getline(file, line));
+}
+
+int CAM::Utils::CpuTopology::ReadInt(const std::string& path, int def)
+{
+	std::string line;
+	if (!ReadLine(path, line))
+	{
+		return def;
+	}
+
+	try
+	{
+		return std::stoi(line);
+	}
+	catch (const std::exception&)
+	{
+		return def;
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Which CPUs we have, which physical core each belongs to and which L2 and L3
+ * they share. Read once from /sys/devices/system/cpu.
+ *
+ * Only CPUs we're allowed to run on count, as told by our affinity mask when
+ * first asked, so we respect taskset, cgroup cpusets and the like.
+ *
+ * If /sys can't be read we know nothing, so every CPU id is -1, meaning
+ * "anywhere", and every CPU is equally far from every other.
+ */
+
+#ifndef CAM_UTILS_CPUTOPOLOGY_HPP
+#define CAM_UTILS_CPUTOPOLOGY_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace CAM
+{
+namespace Utils
+{
+class CpuTopology
+{
+	public:
+	struct Cpu
+	{
+		int id;
+		int package;
+		int core; // Unique within the package
+		int l2; // Lowest id of the CPUs sharing our L2, -1 if unknown
+		int l3; // Ditto for the L3
+	};
+
+	[[nodiscard]] static const CpuTopology& Get();
+
+	CpuTopology(const CpuTopology&) = delete;
+	CpuTopology(CpuTopology&&) = delete;
+	CpuTopology& operator=(const CpuTopology&)& = delete;
+	CpuTopology& operator=(CpuTopology&&)& = delete;
+
+	[[nodiscard]] inline const std::vector<Cpu>& Cpus() const { return cpus; }
+
+	// The CPUs to put count workers on, neighbours sharing caches next to
+	// each other. We use one CPU per physical core before doubling up on SMT
+	// siblings. If count is 0 we pick one worker per physical core, or per
+	// CPU we may use if we know nothing.
+	[[nodiscard]] std::vector<int> WorkerCpus(size_t count) const;
+
+	// 0 for the same physical core, 1 for a shared L2, 2 for a shared L3, 3
+	// for the same package and 4 for anything further.
+	[[nodiscard]] size_t Distance(int a, int b) const;
+
+	// Returns false if we couldn't. Does nothing for -1.
+	static bool PinThisThread(int cpu);
+
+	private:
+	CpuTopology();
+
+	[[nodiscard]] const Cpu* Find(int id) const;
+
+	// Empty if we can't tell.
+	[[nodiscard]] static std::vector<int> AllowedCpus();
+
+	[[nodiscard]] static std::vector<int> ParseList(const std::string& list);
+	[[nodiscard]] static bool ReadLine(const std::string& path, std::string& line);
+	[[nodiscard]] static int ReadInt(const std::string& path, int def);
+
+	std::vector<Cpu> cpus;
+	std::vector<int> physicalCores; // One CPU of each, sorted by locality
+	size_t allowedCount; // How many CPUs we may use, even if /sys can't be read
+};
+}
+}
+
+#endif
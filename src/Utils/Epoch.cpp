@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Epoch.hpp"
+#include "Assert.hpp"
+
+#include <algorithm>
+
+std::atomic<uint64_t> CAM::Utils::Epoch::globalEpoch = 2;
+std::array<CAM::Utils::Epoch::Slot, CAM::Utils::Epoch::maxThreads> CAM::Utils::Epoch::slots;
+std::atomic<size_t> CAM::Utils::Epoch::slotsUsed = 0;
+std::mutex CAM::Utils::Epoch::orphansMutex;
+std::vector<CAM::Utils::Epoch::Retired> CAM::Utils::Epoch::orphans;
+uint64_t CAM::Utils::Epoch::orphansEpoch = 0;
+
+CAM::Utils::Epoch::ThreadRecord::ThreadRecord()
+{
+	for (slot = 0; slot < maxThreads; ++slot)
+	{
+		bool expected = false;
+		if (slots[slot].taken.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+		{
+			break;
+		}
+	}
+	ASSERT(slot != maxThreads, "Too many threads for Utils::Epoch.");
+
+	size_t used = slotsUsed.load(std::memory_order_relaxed);
+	while (used < slot + 1 && !slotsUsed.compare_exchange_weak(used, slot + 1, std::memory_order_acq_rel)) {}
+}
+
+CAM::Utils::Epoch::ThreadRecord::~ThreadRecord()
+{
+	slots[slot].state.store(0, std::memory_order_release);
+
+	{
+		std::unique_lock<std::mutex> lock(orphansMutex);
+		for (auto& bag : limbo)
+		{
+			orphans.insert(std::end(orphans), std::begin(bag), std::end(bag));
+			bag.clear();
+		}
+		orphansEpoch = globalEpoch.load(std::memory_order_acquire);
+	}
+
+	slots[slot].taken.store(false, std::memory_order_release);
+}
+
+CAM::Utils::Epoch::ThreadRecord& CAM::Utils::Epoch::Record()
+{
+	static thread_local ThreadRecord record;
+	return record;
+}
+
+void CAM::Utils::Epoch::Enter()
+{
+	auto& record = Record();
+	if (record.depth++ == 0)
+	{
+		Announce(record, globalEpoch.load(std::memory_order_relaxed));
+	}
+}
+
+void CAM::Utils::Epoch::Leave()
+{
+	auto& record = Record();
+	ASSERT(record.depth != 0, "Left an epoch we never entered.");
+	if (--record.depth == 0)
+	{
+		slots[record.slot].state.store(record.epoch * 2, std::memory_order_release);
+	}
+}
+
+void CAM::Utils::Epoch::Announce(ThreadRecord& record, uint64_t global)
+{
+	// seq_cst so whoever moves the epoch on either sees us in it, or we see
+	// their new epoch and anything they retired before is already unreachable.
+	uint64_t was = record.epoch;
+	record.epoch = global;
+	slots[record.slot].state.store(global * 2 + 1, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	uint64_t now = globalEpoch.load(std::memory_order_relaxed);
+	if (now != global)
+	{
+		record.epoch = now;
+		slots[record.slot].state.store(now * 2 + 1, std::memory_order_seq_cst);
+	}
+
+	// Workers Enter around every job, so only look for things to free once
+	// there might be some.
+	if (record.epoch != was)
+	{
+		Reclaim(record);
+	}
+}
+
+void CAM::Utils::Epoch::Retire(void* ptr, void (*deleter)(void*))
+{
+	auto& record = Record();
+	uint64_t global = globalEpoch.load(std::memory_order_acquire);
+
+	size_t bag = global % 3;
+	if (record.limboEpoch[bag] != global)
+	{
+		// At least three epochs old, so safe.
+		Free(record.limbo[bag]);
+		record.limboEpoch[bag] = global;
+	}
+	record.limbo[bag].push_back(Retired{ptr, deleter});
+
+	if (++record.sinceAdvance >= advanceInterval)
+	{
+		record.sinceAdvance = 0;
+		TryAdvance();
+		Reclaim(record);
+	}
+}
+
+void CAM::Utils::Epoch::TryAdvance()
+{
+	uint64_t global = globalEpoch.load(std::memory_order_seq_cst);
+	size_t used = slotsUsed.load(std::memory_order_acquire);
+	for (size_t i = 0; i < used; ++i)
+	{
+		uint64_t state = slots[i].state.load(std::memory_order_seq_cst);
+		if ((state & 1) != 0 && state / 2 != global)
+		{
+			return; // Someone's still in an older epoch
+		}
+	}
+
+	globalEpoch.compare_exchange_strong(global, global + 1, std::memory_order_seq_cst);
+}
+
+// Things retired in epoch e are unreachable to anyone in epoch e + 1, and
+// nobody is left in epoch e once the global epoch reaches e + 2.
+void CAM::Utils::Epoch::Reclaim(ThreadRecord& record)
+{
+	uint64_t global = globalEpoch.load(std::memory_order_acquire);
+	for (size_t i = 0; i < record.limbo.size(); ++i)
+	{
+		if (!record.limbo[i].empty() && record.limboEpoch[i] + 2 <= global)
+		{
+			Free(record.limbo[i]);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(orphansMutex, std::try_to_lock);
+	if (lock && !orphans.empty() && orphansEpoch + 2 <= global)
+	{
+		Free(orphans);
+	}
+}
+
+void CAM::Utils::Epoch::Free(std::vector<Retired>& bag)
+{
+	for (auto& retired : bag)
+	{
+		retired.deleter(retired.ptr);
+	}
+	bag.clear();
+}
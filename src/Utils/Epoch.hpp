@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Epoch based reclamation. Things other threads might still be looking at are
+ * Retired instead of deleted, and only deleted once every thread which was
+ * active at the time has since been seen quiescent, holding no pointers.
+ *
+ * Long lived threads, like workers, Enter once, call Quiesce whenever they
+ * hold nothing (say, between jobs) and Leave before sleeping or dying. Anyone
+ * else wraps what they do in a Guard.
+ *
+ * Nobody waits on anyone, retired things just pile up till the epoch moves on.
+ * So a thread in the epoch holds up everyone's reclamation for as long as it
+ * stays in it. Never wait, block or run jobs while in it: workers Leave
+ * around every job they run, and Guards are only for the few lines which
+ * touch something which could be retired.
+ */
+
+#ifndef CAM_UTILS_EPOCH_HPP
+#define CAM_UTILS_EPOCH_HPP
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+namespace CAM
+{
+namespace Utils
+{
+class Epoch
+{
+	public:
+	static constexpr size_t maxThreads = 256;
+
+	// How many things a thread retires between tries to move the epoch on.
+	static constexpr size_t advanceInterval = 64;
+
+	static void Enter();
+	static void Leave();
+
+	// Whether this thread is in the epoch, so holding up reclamation.
+	[[nodiscard]] static inline bool Active()
+	{
+		return Record().depth != 0;
+	}
+
+	// Cheap unless the epoch moved on since we last said so.
+	static inline void Quiesce()
+	{
+		auto& record = Record();
+		uint64_t global = globalEpoch.load(std::memory_order_relaxed);
+		if (record.depth != 0 && record.epoch != global)
+		{
+			Announce(record, global);
+		}
+	}
+
+	template<typename T>
+	static inline void Retire(T* ptr)
+	{
+		Retire(ptr, [] (void* p) { delete static_cast<T*>(p); });
+	}
+	static void Retire(void* ptr, void (*deleter)(void*));
+
+	class Guard
+	{
+		public:
+		inline Guard() { Enter(); }
+		inline ~Guard() { Leave(); }
+
+		Guard(const Guard&) = delete;
+		Guard(Guard&&) = delete;
+		Guard& operator=(const Guard&)& = delete;
+		Guard& operator=(Guard&&)& = delete;
+	};
+
+	private:
+	struct Retired
+	{
+		void* ptr;
+		void (*deleter)(void*);
+	};
+
+	struct ThreadRecord
+	{
+		ThreadRecord();
+		~ThreadRecord();
+
+		size_t slot;
+		size_t depth = 0;
+		uint64_t epoch = 0;
+		size_t sinceAdvance = 0;
+
+		// Indexed by epoch % 3, along with the epoch they were retired in.
+		std::array<std::vector<Retired>, 3> limbo;
+		std::array<uint64_t, 3> limboEpoch = {};
+	};
+
+	// Each slot is the thread's epoch times two, plus one if active.
+	struct alignas(64) Slot
+	{
+		std::atomic<uint64_t> state = 0;
+		std::atomic<bool> taken = false;
+	};
+
+	[[nodiscard]] static ThreadRecord& Record();
+	static void Announce(ThreadRecord& record, uint64_t global);
+	static void TryAdvance();
+	static void Reclaim(ThreadRecord& record);
+	static void Free(std::vector<Retired>& bag);
+
+	static std::atomic<uint64_t> globalEpoch;
+	static std::array<Slot, maxThreads> slots;
+	static std::atomic<size_t> slotsUsed;
+
+	// Left behind by threads which died before they could free them.
+	static std::mutex orphansMutex;
+	static std::vector<Retired> orphans;
+	static uint64_t orphansEpoch;
+};
+}
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EventCount.hpp"
+
+#include <climits>
+#include <ctime>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+void CAM::Utils::EventCount::FutexWait(std::atomic<uint32_t>* word, uint32_t val)
+{
+#ifdef __linux__
+	// Spurious wakeups and EAGAIN are fine, CommitWait rechecks.
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+#else
+	word->wait(val, std::memory_order_acquire);
+#endif
+}
+
+void CAM::Utils::EventCount::FutexWaitFor(std::atomic<uint32_t>* word, uint32_t val, std::chrono::nanoseconds timeout)
+{
+#ifdef __linux__
+	timespec ts;
+	ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+	ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+	// Timeouts, like spurious wakeups, are for WaitFor to sort out.
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, val, &ts, nullptr, 0);
+#else
+	// Atomics can't wait with a timeout, so nap instead, WaitFor rechecks.
+	(void)word;
+	(void)val;
+	std::this_thread::sleep_for(timeout);
+#endif
+}
+
+void CAM::Utils::EventCount::FutexWake(std::atomic<uint32_t>* word, bool all)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#else
+	if (all) { word->notify_all(); }
+	else { word->notify_one(); }
+#endif
+}
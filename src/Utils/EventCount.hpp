@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * An eventcount, which lets threads sleep till some condition they check
+ * themselves is met, without a mutex. It's two 32 bit words, one of which is
+ * a futex.
+ *
+ * To wait by hand:
+ *
+ *	auto key = ec.PrepareWait();
+ *	if (condition) { ec.CancelWait(); }
+ *	else { ec.CommitWait(key); } // Returns straight away if notified since
+ *	                             // PrepareWait
+ *
+ * Or just call Wait(pred), which spins for a bit before parking, or WaitFor
+ * to give up after a while. Whoever makes the condition true must call
+ * NotifyOne or NotifyAll afterwards, both of which are a single load when
+ * nobody is waiting.
+ *
+ * Something which can't sleep on us itself, like a fiber, can have our
+ * notifications forwarded to an eventcount someone else sleeps on instead, see
+ * Forward.
+ */
+
+#ifndef CAM_UTILS_EVENTCOUNT_HPP
+#define CAM_UTILS_EVENTCOUNT_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace CAM
+{
+namespace Utils
+{
+class EventCount
+{
+	public:
+	using Key = uint32_t;
+
+	static constexpr size_t spinCount = 128;
+	static constexpr size_t forwardSlots = 8;
+
+	EventCount() = default;
+
+	EventCount(const EventCount&) = delete;
+	EventCount(EventCount&&) = delete;
+	EventCount& operator=(const EventCount&)& = delete;
+	EventCount& operator=(EventCount&&)& = delete;
+
+	[[nodiscard]] inline Key PrepareWait()
+	{
+		waiters.fetch_add(1, std::memory_order_seq_cst);
+		return epoch.load(std::memory_order_seq_cst);
+	}
+
+	inline void CancelWait()
+	{
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	inline void CommitWait(Key key)
+	{
+		while (epoch.load(std::memory_order_acquire) == key)
+		{
+			FutexWait(&epoch, key);
+		}
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Returns whether pred was met, false if we timed out first.
+	template<class Pred>
+	[[nodiscard]] inline bool WaitFor(Pred pred, std::chrono::nanoseconds timeout)
+	{
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		for (size_t i = 0; i < spinCount; ++i)
+		{
+			if (pred())
+			{
+				return true;
+			}
+			CpuRelax();
+		}
+
+		while (true)
+		{
+			auto key = PrepareWait();
+			if (pred())
+			{
+				CancelWait();
+				return true;
+			}
+
+			auto left = deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::nanoseconds::zero())
+			{
+				CancelWait();
+				return false;
+			}
+
+			if (epoch.load(std::memory_order_acquire) == key)
+			{
+				FutexWaitFor(&epoch, key, left);
+			}
+			CancelWait();
+		}
+	}
+
+	template<class Pred>
+	inline void Wait(Pred pred)
+	{
+		for (size_t i = 0; i < spinCount; ++i)
+		{
+			if (pred())
+			{
+				return;
+			}
+			CpuRelax();
+		}
+
+		while (true)
+		{
+			auto key = PrepareWait();
+			if (pred())
+			{
+				CancelWait();
+				return;
+			}
+			CommitWait(key);
+		}
+	}
+
+	inline void NotifyOne() { Notify(false); }
+	inline void NotifyAll() { Notify(true); }
+
+	// Has every notification NotifyAll to as well, till Unforward. Like with
+	// PrepareWait, recheck the condition after, it may have been met before
+	// we were listening. Returns false if we've no room, so whoever sleeps on
+	// to mustn't count on us. to must outlive being forwarded to.
+	[[nodiscard]] inline bool Forward(EventCount* to)
+	{
+		waiters.fetch_add(forwardedOne, std::memory_order_seq_cst);
+		for (auto& slot : forwards)
+		{
+			EventCount* expected = nullptr;
+			if
+			(
+				slot.load(std::memory_order_relaxed) == nullptr
+				&& slot.compare_exchange_strong(expected, to, std::memory_order_seq_cst)
+			)
+			{
+				// Pairs with Notify, so either they see us or we see their change.
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				return true;
+			}
+		}
+
+		waiters.fetch_sub(forwardedOne, std::memory_order_relaxed);
+		return false;
+	}
+
+	// Undoes one Forward to to.
+	inline void Unforward(EventCount* to)
+	{
+		for (auto& slot : forwards)
+		{
+			EventCount* expected = to;
+			if (slot.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel, std::memory_order_relaxed))
+			{
+				waiters.fetch_sub(forwardedOne, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+
+	private:
+	// Forwards are counted in waiters' top half, so Notify still only loads
+	// one word when nobody is waiting either way.
+	static constexpr uint32_t forwardedOne = uint32_t(1) << 16;
+
+	inline void Notify(bool all)
+	{
+		// Pairs with PrepareWait, so either they see our change or we see them.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t waiting = waiters.load(std::memory_order_relaxed);
+		if (waiting == 0)
+		{
+			return;
+		}
+
+		if ((waiting & (forwardedOne - 1)) != 0)
+		{
+			epoch.fetch_add(1, std::memory_order_release);
+			FutexWake(&epoch, all);
+		}
+
+		if (waiting >= forwardedOne)
+		{
+			for (auto& slot : forwards)
+			{
+				auto to = slot.load(std::memory_order_acquire);
+				if (to != nullptr)
+				{
+					to->NotifyAll();
+				}
+			}
+		}
+	}
+
+	static inline void CpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	static void FutexWait(std::atomic<uint32_t>* word, uint32_t val);
+	static void FutexWaitFor(std::atomic<uint32_t>* word, uint32_t val, std::chrono::nanoseconds timeout);
+	static void FutexWake(std::atomic<uint32_t>* word, bool all);
+
+	std::atomic<uint32_t> epoch = 0;
+	std::atomic<uint32_t> waiters = 0;
+	std::array<std::atomic<EventCount*>, forwardSlots> forwards = {};
+};
+}
+}
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Fiber.hpp"
+#include "Assert.hpp"
+
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#endif
+
+// CAMFiberSwitch(from, to) pushes the callee-saved registers and the FP
+// control state onto the current stack, stores the stack pointer in *from,
+// then switches to the stack pointer to and pops what was pushed there. Its
+// ret then returns wherever that side last called CAMFiberSwitch from.
+//
+// A fresh fiber's stack gets a frame laid out the same, which "returns" into
+// EntryPoint, see Reset.
+extern "C" void CAMFiberSwitch(void** from, void* to);
+
+namespace
+{
+#if defined(__x86_64__)
+asm
+(
+	".text\n"
+	".globl CAMFiberSwitch\n"
+	".type CAMFiberSwitch, @function\n"
+	".p2align 4\n"
+	"CAMFiberSwitch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $16, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $16, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size CAMFiberSwitch, .-CAMFiberSwitch\n"
+);
+
+// MXCSR and the x87 control word, six callee-saved registers, then where to
+// return to. Left 8 off 16 byte alignment once that's popped, like after a
+// call.
+constexpr size_t switchFrameSize = 80;
+constexpr size_t returnAddressOffset = 64;
+
+void SaveControlState(std::byte* frame)
+{
+	uint32_t mxcsr;
+	uint16_t fpucw;
+	asm volatile ("stmxcsr %0" : "=m"(mxcsr));
+	asm volatile ("fnstcw %0" : "=m"(fpucw));
+	std::memcpy(frame, &mxcsr, sizeof(mxcsr));
+	std::memcpy(frame + 4, &fpucw, sizeof(fpucw));
+}
+#elif defined(__aarch64__)
+asm
+(
+	".text\n"
+	".globl CAMFiberSwitch\n"
+	".type CAMFiberSwitch, %function\n"
+	".p2align 4\n"
+	"CAMFiberSwitch:\n"
+	"	sub sp, sp, #176\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mrs x9, fpcr\n"
+	"	str x9, [sp, #160]\n"
+	"	mov x9, sp\n"
+	"	str x9, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	ldr x9, [sp, #160]\n"
+	"	msr fpcr, x9\n"
+	"	add sp, sp, #176\n"
+	"	ret\n"
+	".size CAMFiberSwitch, .-CAMFiberSwitch\n"
+);
+
+// x19 to x28, the frame pointer, the link register we return to, d8 to d15
+// and FPCR, kept 16 byte aligned.
+constexpr size_t switchFrameSize = 176;
+constexpr size_t returnAddressOffset = 88;
+
+void SaveControlState(std::byte* frame)
+{
+	uint64_t fpcr;
+	asm volatile ("mrs %0, fpcr" : "=r"(fpcr));
+	std::memcpy(frame + 160, &fpcr, sizeof(fpcr));
+}
+#else
+#error "Fiber has no context switch for this architecture yet, see Fiber.cpp."
+#endif
+}
+
+thread_local CAM::Utils::Fiber* CAM::Utils::Fiber::current = nullptr;
+thread_local CAM::Utils::EventCount* CAM::Utils::Fiber::wake = nullptr;
+
+CAM::Utils::Fiber::Fiber(size_t stackSize)
+{
+	size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	this->stackSize = (stackSize + pageSize - 1) & ~(pageSize - 1);
+	mappingSize = this->stackSize + pageSize;
+
+	void* mapped = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (mapped == MAP_FAILED)
+	{
+		throw std::runtime_error("Could not map fiber stack.");
+	}
+	mapping = static_cast<std::byte*>(mapped);
+
+	// Stacks grow down, so the guard goes at the bottom.
+	if (mprotect(mapping, pageSize, PROT_NONE) != 0)
+	{
+		munmap(mapping, mappingSize);
+		throw std::runtime_error("Could not protect fiber stack guard page.");
+	}
+	stack = mapping + pageSize;
+}
+
+CAM::Utils::Fiber::~Fiber()
+{
+	munmap(mapping, mappingSize);
+}
+
+void CAM::Utils::Fiber::Reset(Func entry)
+{
+	ASSERT(finished, "Can't reset a fiber which is still running.");
+
+	this->entry = std::move(entry);
+	waitingOn = nullptr;
+	finished = false;
+	exception = nullptr;
+
+	// A frame for CAMFiberSwitch to pop, which returns into EntryPoint. What
+	// EntryPoint would return to is left null, ending backtraces there.
+#if defined(__SANITIZE_ADDRESS__)
+	// The last run never unwound its frames, so ASan still has them poisoned.
+	__asan_unpoison_memory_region(stack, stackSize);
+#endif
+
+	auto top = reinterpret_cast<uintptr_t>(stack + stackSize) & ~uintptr_t{15};
+	auto frame = reinterpret_cast<std::byte*>(top - switchFrameSize);
+	std::memset(frame, 0, top - reinterpret_cast<uintptr_t>(frame));
+
+	SaveControlState(frame);
+	void (*entryPoint)() = &Fiber::EntryPoint;
+	std::memcpy(frame + returnAddressOffset, &entryPoint, sizeof(entryPoint));
+
+	context = frame;
+}
+
+void CAM::Utils::Fiber::Resume()
+{
+	ASSERT(current == nullptr, "Fibers can't resume other fibers.");
+	ASSERT(!finished, "Can't resume a fiber which finished.");
+
+	current = this;
+	CAMFiberSwitch(&callerContext, context);
+	current = nullptr;
+
+	if (exception != nullptr)
+	{
+		auto e = exception;
+		exception = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+void CAM::Utils::Fiber::Suspend()
+{
+	CAMFiberSwitch(&context, callerContext);
+}
+
+void CAM::Utils::Fiber::EntryPoint()
+{
+	Fiber* self = current;
+
+	try
+	{
+		self->entry();
+	}
+	catch (...)
+	{
+		self->exception = std::current_exception();
+	}
+
+	self->entry = nullptr;
+	self->finished = true;
+
+	// Never switched back to, Reset starts the fiber over.
+	CAMFiberSwitch(&self->context, self->callerContext);
+}
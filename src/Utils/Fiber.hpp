@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A simple fiber. Switching to and from one only saves and restores the
+ * registers calls must preserve, in a few lines of assembly, so unlike
+ * swapcontext it never makes a syscall. Only x86-64 and AArch64 are done, see
+ * Fiber.cpp.
+ *
+ * Stacks are mapped with an inaccessible guard page below them, so running
+ * off the end of one faults instead of quietly corrupting whatever was next.
+ *
+ * A fiber is started with Reset and run with Resume. Resume returns once the
+ * fiber finishes or when code on it calls YieldUntil with a predicate that
+ * isn't met yet. Whoever called Resume should then check CanResume every so
+ * often and Resume the fiber again once it's true. If they SetWake, fibers
+ * waiting on an EventCount have it notify their wake, so they can sleep on
+ * that instead of checking, as long as every suspended fiber WillNotify.
+ *
+ * Fibers never migrate between threads, so resume them from the thread which
+ * started them. Exceptions thrown on a fiber are rethrown from Resume.
+ */
+
+#ifndef CAM_UTILS_FIBER_HPP
+#define CAM_UTILS_FIBER_HPP
+
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+
+#include "InlineFunction.tpp"
+#include "EventCount.hpp"
+
+namespace CAM
+{
+namespace Utils
+{
+class Fiber
+{
+	public:
+	using Func = InlineFunction<void(), 48>;
+	using Pred = InlineFunction<bool(), 16>;
+
+	Fiber(size_t stackSize);
+	~Fiber();
+
+	Fiber(const Fiber&) = delete;
+	Fiber(Fiber&&) = delete;
+	Fiber& operator=(const Fiber&)& = delete;
+	Fiber& operator=(Fiber&&)& = delete;
+
+	void Reset(Func entry);
+	void Resume();
+
+	[[nodiscard]] inline bool Finished() const { return finished; }
+	[[nodiscard]] inline bool CanResume() const { return !waitingOn || waitingOn(); }
+	// Whether whatever we're waiting on will notify our thread's wake once
+	// we might be able to resume.
+	[[nodiscard]] inline bool WillNotify() const { return willNotify; }
+
+	[[nodiscard]] static inline Fiber* Current() { return current; }
+
+	// What fibers resumed from this thread have notified, see YieldUntil.
+	static inline void SetWake(EventCount* wake) { Fiber::wake = wake; }
+
+	// Suspends the current fiber till pred is met. Returns false, without
+	// waiting, if we are not on a fiber.
+	template<class P>
+	static inline bool YieldUntil(P pred)
+	{
+		Fiber* fiber = current;
+		if (fiber == nullptr)
+		{
+			return false;
+		}
+
+		while (!pred())
+		{
+			fiber->waitingOn = pred;
+			fiber->Suspend();
+		}
+		fiber->waitingOn = nullptr;
+
+		return true;
+	}
+
+	// Like the above, for a pred which is only met once event is notified,
+	// which then notifies our thread's wake too.
+	template<class P>
+	static inline bool YieldUntil(P pred, EventCount& event)
+	{
+		Fiber* fiber = current;
+		if (fiber == nullptr)
+		{
+			return false;
+		}
+
+		while (!pred())
+		{
+			EventCount* wake = Fiber::wake;
+			bool forwarded = wake != nullptr && event.Forward(wake);
+			if (!pred())
+			{
+				fiber->waitingOn = pred;
+				fiber->willNotify = forwarded;
+				fiber->Suspend();
+				fiber->willNotify = false;
+			}
+			if (forwarded)
+			{
+				event.Unforward(wake);
+			}
+		}
+		fiber->waitingOn = nullptr;
+
+		return true;
+	}
+
+	private:
+	static void EntryPoint();
+	void Suspend();
+
+	// Where each side's registers were saved, on its own stack.
+	void* context = nullptr;
+	void* callerContext = nullptr;
+
+	// The guard page, then the stack.
+	std::byte* mapping;
+	size_t mappingSize;
+	std::byte* stack;
+	size_t stackSize;
+
+	Func entry;
+	Pred waitingOn;
+	bool willNotify = false;
+	bool finished = true;
+	std::exception_ptr exception;
+
+	static thread_local Fiber* current;
+	static thread_local EventCount* wake;
+};
+}
+}
+
+#endif
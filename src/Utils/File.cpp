@@ -19,6 +19,13 @@
 
 #include "File.hpp"
 
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 CAM::Utils::File::File(std::string filename, std::string mode)
 {
 	file = fopen(filename.c_str(), mode.c_str());
@@ -41,15 +48,131 @@ std::string CAM::Utils::File::GetContents()
 {
 	const size_t block = 2048;
 
-	char buf[block] = {};
+	char buf[block];
 	std::string ret = "";
 
-    while (fread(buf, 1, sizeof(buf), file) > 0)
+	// Appended by length, as binaries like SPIR-V have NULs in them.
+	size_t read;
+	while ((read = fread(buf, 1, sizeof(buf), file)) > 0)
 	{
-		ret += std::string(buf);
-    }
+		ret.append(buf, read);
+	}
 
 	rewind(file);
 
 	return ret;
 }
+
+CAM::Utils::MappedFile::MappedFile(std::string filename, Access access, bool hugePages)
+{
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		throw std::runtime_error("Failed to open file.");
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("Failed to stat file.");
+	}
+
+	size = static_cast<size_t>(info.st_size);
+	if (size == 0)
+	{
+		close(fd); // Can't map nothing
+		return;
+	}
+
+	// Reserve enough to slide the file up to a huge page boundary, then map it
+	// over the reservation there.
+	const size_t hugePage = 2 * 1024 * 1024;
+	void* at = nullptr;
+	int flags = MAP_PRIVATE;
+	if (hugePages)
+	{
+		size_t reserved = size + hugePage;
+		void* reservation = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (reservation != MAP_FAILED)
+		{
+			auto start = reinterpret_cast<uintptr_t>(reservation);
+			auto aligned = (start + hugePage - 1) & ~(hugePage - 1);
+			at = reinterpret_cast<void*>(aligned);
+			flags |= MAP_FIXED;
+
+			// Give back the slack on either side.
+			if (aligned != start)
+			{
+				munmap(reservation, aligned - start);
+			}
+			size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			size_t used = (size + pageSize - 1) & ~(pageSize - 1);
+			size_t tail = start + reserved - (aligned + used);
+			if (tail != 0)
+			{
+				munmap(reinterpret_cast<void*>(aligned + used), tail);
+			}
+		}
+	}
+
+	void* mapped = mmap(at, size, PROT_READ, flags, fd, 0);
+	close(fd); // The mapping keeps the file alive
+	if (mapped == MAP_FAILED)
+	{
+		if (at != nullptr)
+		{
+			munmap(at, size);
+		}
+		throw std::runtime_error("Failed to map file.");
+	}
+	data = static_cast<const std::byte*>(mapped);
+
+	// Only hints, so we don't care if they fail.
+	switch (access)
+	{
+		case Access::Normal:
+			break;
+		case Access::Sequential:
+			madvise(mapped, size, MADV_SEQUENTIAL);
+			madvise(mapped, size, MADV_WILLNEED);
+			break;
+		case Access::Random:
+			madvise(mapped, size, MADV_RANDOM);
+			break;
+	}
+
+	if (hugePages)
+	{
+		madvise(mapped, size, MADV_HUGEPAGE);
+	}
+}
+
+CAM::Utils::MappedFile::~MappedFile()
+{
+	if (data != nullptr)
+	{
+		munmap(const_cast<std::byte*>(data), size);
+	}
+}
+
+CAM::Utils::FileView CAM::Utils::MappedFile::View(size_t offset, size_t length) const
+{
+	offset = std::min(offset, size);
+	return FileView(data + offset, std::min(length, size - offset));
+}
+
+void CAM::Utils::MappedFile::WillNeed(size_t offset, size_t length) const
+{
+	auto view = View(offset, length);
+	if (view.empty())
+	{
+		return;
+	}
+
+	// madvise wants page aligned addresses.
+	size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	auto start = reinterpret_cast<uintptr_t>(view.data()) & ~(pageSize - 1);
+	auto end = reinterpret_cast<uintptr_t>(view.data() + view.size());
+	madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+}
@@ -19,6 +19,9 @@
 
 /*
  * A nice, incomplete, wrapper for file IO.
+ *
+ * MappedFile maps a whole file read-only, and hands out FileViews of it
+ * without copying anything. Prefer it for big blobs like shaders and assets.
  */
 
 #ifndef CAM_UTILS_FILE_HPP
@@ -26,7 +29,9 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cstddef>
 #include <string>
+#include <span>
 #include <stdexcept>
 
 namespace CAM
@@ -49,6 +54,45 @@ class File
 	private:
 	FILE* file;
 };
+
+using FileView = std::span<const std::byte>;
+
+class MappedFile
+{
+	public:
+	// Passed on to the kernel, so it knows how far to read ahead.
+	enum class Access
+	{
+		Normal,
+		Sequential,
+		Random,
+	};
+
+	// With hugePages the mapping is 2MiB aligned and the kernel asked to back
+	// it with huge pages, if it can for this file system.
+	MappedFile(std::string filename, Access access = Access::Sequential, bool hugePages = false);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+	MappedFile& operator=(const MappedFile&)& = delete;
+	MappedFile& operator=(MappedFile&&)& = delete;
+
+	// Valid for as long as we are.
+	[[nodiscard]] inline FileView View() const { return FileView(data, size); }
+
+	// Clamped to the end of the file.
+	[[nodiscard]] FileView View(size_t offset, size_t length) const;
+
+	// Starts reading the range in, so it's there by the time we look.
+	void WillNeed(size_t offset, size_t length) const;
+
+	[[nodiscard]] inline size_t Size() const { return size; }
+
+	private:
+	const std::byte* data = nullptr; // nullptr for empty files
+	size_t size = 0;
+};
 }
 }
 
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FrameArena.hpp"
+#include "Assert.hpp"
+
+#include <algorithm>
+
+CAM::Utils::FrameArena::FrameArena(size_t framesInFlight, size_t blockSize)
+	: framesInFlight(framesInFlight),
+	blockSize(blockSize),
+	id(nextId.fetch_add(1, std::memory_order_relaxed)),
+	resource(this)
+{
+	ASSERT(framesInFlight != 0, "FrameArena needs at least one frame.");
+}
+
+CAM::Utils::FrameArena::~FrameArena()
+{
+	for (auto& thread : threads)
+	{
+		for (auto& slot : thread->slots)
+		{
+			for (auto& block : slot.blocks)
+			{
+				::operator delete(block.memory, std::align_val_t(64));
+			}
+		}
+	}
+}
+
+void CAM::Utils::FrameArena::BeginFrame(uint64_t frame)
+{
+	size_t slotIndex = frame % framesInFlight;
+
+	// Nobody is allocating into this slot, it's framesInFlight frames old.
+	{
+		std::unique_lock<std::mutex> lock(threadsMutex);
+		for (auto& thread : threads)
+		{
+			auto& slot = thread->slots[slotIndex];
+			slot.nextBlock = 0;
+			slot.cursor = nullptr;
+			slot.end = nullptr;
+		}
+	}
+
+	// Jobs of the frame see this, as they're submitted after.
+	currentSlot.store(slotIndex, std::memory_order_release);
+}
+
+CAM::Utils::FrameArena::ThreadArena* CAM::Utils::FrameArena::Register()
+{
+	auto thread = std::make_unique<ThreadArena>();
+	thread->slots.resize(framesInFlight);
+
+	std::unique_lock<std::mutex> lock(threadsMutex);
+	threads.push_back(std::move(thread));
+	return threads.back().get();
+}
+
+void* CAM::Utils::FrameArena::AllocateSlow(Slot& slot, size_t size, size_t align)
+{
+	size_t needed = size + align;
+
+	// Blocks too small for this get skipped for the rest of the frame.
+	while (slot.nextBlock < slot.blocks.size() && slot.blocks[slot.nextBlock].size < needed)
+	{
+		++slot.nextBlock;
+	}
+
+	if (slot.nextBlock == slot.blocks.size())
+	{
+		size_t newSize = std::max(blockSize, needed);
+		slot.blocks.push_back(Block{static_cast<std::byte*>(::operator new(newSize, std::align_val_t(64))), newSize});
+	}
+
+	auto& block = slot.blocks[slot.nextBlock++];
+	slot.cursor = block.memory;
+	slot.end = block.memory + block.size;
+
+	auto p = (reinterpret_cast<uintptr_t>(slot.cursor) + align - 1) & ~(uintptr_t{align} - 1);
+	slot.cursor = reinterpret_cast<std::byte*>(p + size);
+	return reinterpret_cast<void*>(p);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Memory for things which die with the frame. Allocating is a pointer bump
+ * into the calling thread's own blocks, and nothing is ever freed on its own.
+ * Instead BeginFrame frees everything allocated framesInFlight frames ago, all
+ * at once, keeping the blocks for reuse.
+ *
+ * So only allocate from jobs of the current frame, for things nobody looks at
+ * once the frame framesInFlight after it begins. Destructors aren't run, stick
+ * to trivially destructible things, or containers using Resource().
+ */
+
+#ifndef CAM_UTILS_FRAMEARENA_HPP
+#define CAM_UTILS_FRAMEARENA_HPP
+
+#include <vector>
+#include <utility>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+
+namespace CAM
+{
+namespace Utils
+{
+class FrameArena
+{
+	public:
+	FrameArena(size_t framesInFlight, size_t blockSize);
+	~FrameArena();
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena(FrameArena&&) = delete;
+	FrameArena& operator=(const FrameArena&)& = delete;
+	FrameArena& operator=(FrameArena&&)& = delete;
+
+	// Call before any of frame's jobs allocate, and after all of the jobs of
+	// frame - framesInFlight are done. frame must go up by one each time.
+	void BeginFrame(uint64_t frame);
+
+	[[nodiscard]] inline void* Allocate(size_t size, size_t align = alignof(std::max_align_t))
+	{
+		auto& slot = Local().slots[currentSlot.load(std::memory_order_acquire)];
+		auto p = (reinterpret_cast<uintptr_t>(slot.cursor) + align - 1) & ~(uintptr_t{align} - 1);
+		if (slot.cursor == nullptr || p + size > reinterpret_cast<uintptr_t>(slot.end))
+		{
+			return AllocateSlow(slot, size, align);
+		}
+
+		slot.cursor = reinterpret_cast<std::byte*>(p + size);
+		return reinterpret_cast<void*>(p);
+	}
+
+	template<typename T, typename... Args>
+	[[nodiscard]] inline T* New(Args&&... args)
+	{
+		return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	// For std::pmr containers. Deallocating through it does nothing.
+	[[nodiscard]] inline std::pmr::memory_resource* Resource() { return &resource; }
+
+	private:
+	struct Block
+	{
+		std::byte* memory;
+		size_t size;
+	};
+
+	// One thread's blocks for one frame.
+	struct Slot
+	{
+		std::vector<Block> blocks;
+		size_t nextBlock = 0;
+		std::byte* cursor = nullptr;
+		std::byte* end = nullptr;
+	};
+
+	struct ThreadArena
+	{
+		std::vector<Slot> slots;
+	};
+
+	class ArenaResource : public std::pmr::memory_resource
+	{
+		public:
+		inline explicit ArenaResource(FrameArena* arena) : arena(arena) {}
+
+		private:
+		inline void* do_allocate(size_t bytes, size_t alignment) override { return arena->Allocate(bytes, alignment); }
+		inline void do_deallocate(void*, size_t, size_t) override {}
+		inline bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+		FrameArena* arena;
+	};
+
+	[[nodiscard]] inline ThreadArena& Local()
+	{
+		// Usually just the one arena.
+		static thread_local std::vector<std::pair<uint64_t, ThreadArena*>> cache;
+		for (auto& [arenaId, arena] : cache)
+		{
+			if (arenaId == id)
+			{
+				return *arena;
+			}
+		}
+
+		cache.emplace_back(id, Register());
+		return *cache.back().second;
+	}
+
+	[[nodiscard]] ThreadArena* Register();
+	[[nodiscard]] void* AllocateSlow(Slot& slot, size_t size, size_t align);
+
+	const size_t framesInFlight;
+	const size_t blockSize;
+
+	// Tells apart arenas which were at the same address, for Local's cache.
+	const uint64_t id;
+	static inline std::atomic<uint64_t> nextId = 1;
+
+	std::atomic<size_t> currentSlot = 0;
+
+	std::mutex threadsMutex;
+	std::vector<std::unique_ptr<ThreadArena>> threads;
+
+	ArenaResource resource;
+};
+}
+}
+
+#endif
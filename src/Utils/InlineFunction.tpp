@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A std::function replacement which never allocates. The callable is stored
+ * inline in Size bytes, anything bigger fails to compile. If that happens,
+ * capture a pointer to your data instead of the data itself.
+ *
+ * Align defaults to what any callable might need. Lower it to pack the
+ * InlineFunction tighter, at the cost of not storing over-aligned callables.
+ */
+
+#ifndef CAM_UTILS_INLINEFUNCTION_TPP
+#define CAM_UTILS_INLINEFUNCTION_TPP
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace CAM
+{
+namespace Utils
+{
+template<typename Sig, size_t Size, size_t Align = alignof(std::max_align_t)>
+class InlineFunction;
+
+template<typename Ret, typename... Args, size_t Size, size_t Align>
+class InlineFunction<Ret(Args...), Size, Align>
+{
+	private:
+	struct Ops
+	{
+		Ret (*invoke)(void* f, Args&&... args);
+		void (*copy)(void* to, const void* from);
+		void (*move)(void* to, void* from);
+		void (*destroy)(void* f);
+	};
+
+	template<typename F>
+	static inline constexpr Ops opsFor =
+	{
+		[](void* f, Args&&... args) -> Ret
+		{
+			return (*static_cast<F*>(f))(std::forward<Args>(args)...);
+		},
+		[](void* to, const void* from) { new (to) F(*static_cast<const F*>(from)); },
+		[](void* to, void* from) { new (to) F(std::move(*static_cast<F*>(from))); },
+		[](void* f) { static_cast<F*>(f)->~F(); }
+	};
+
+	public:
+	static constexpr size_t size = Size;
+
+	InlineFunction() = default;
+	InlineFunction(std::nullptr_t) {}
+
+	template
+	<
+		typename F,
+		typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type
+	>
+	InlineFunction(F&& f)
+	{
+		using D = typename std::decay<F>::type;
+		static_assert(sizeof(D) <= Size, "This callable's captures are too large to store inline. Capture a pointer to them instead.");
+		static_assert(alignof(D) <= Align, "This callable is over-aligned.");
+
+		new (&storage) D(std::forward<F>(f));
+		ops = &opsFor<D>;
+	}
+
+	InlineFunction(const InlineFunction& other) : ops(other.ops)
+	{
+		if (ops != nullptr) { ops->copy(&storage, &other.storage); }
+	}
+
+	InlineFunction(InlineFunction&& other) : ops(other.ops)
+	{
+		if (ops != nullptr) { ops->move(&storage, &other.storage); }
+	}
+
+	InlineFunction& operator=(const InlineFunction& other)
+	{
+		if (this != &other)
+		{
+			Clear();
+			ops = other.ops;
+			if (ops != nullptr) { ops->copy(&storage, &other.storage); }
+		}
+		return *this;
+	}
+
+	InlineFunction& operator=(InlineFunction&& other)
+	{
+		if (this != &other)
+		{
+			Clear();
+			ops = other.ops;
+			if (ops != nullptr) { ops->move(&storage, &other.storage); }
+		}
+		return *this;
+	}
+
+	~InlineFunction() { Clear(); }
+
+	inline Ret operator()(Args... args) const
+	{
+		return ops->invoke(&storage, std::forward<Args>(args)...);
+	}
+
+	inline explicit operator bool() const { return ops != nullptr; }
+
+	private:
+	inline void Clear()
+	{
+		if (ops != nullptr)
+		{
+			ops->destroy(&storage);
+			ops = nullptr;
+		}
+	}
+
+	mutable typename std::aligned_storage<Size, Align>::type storage;
+	const Ops* ops = nullptr;
+};
+}
+}
+
+#endif
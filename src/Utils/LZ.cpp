@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LZ.hpp"
+
+#include <array>
+#include <cstring>
+
+namespace
+{
+inline uint32_t Read32(const std::byte* p)
+{
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// Writes the part of a length which didn't fit in its nibble.
+inline std::byte* WriteLength(std::byte* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = std::byte{255};
+		length -= 255;
+	}
+	*op++ = static_cast<std::byte>(length);
+	return op;
+}
+
+// False if we ran off the end of the input.
+inline bool ReadLength(const std::byte*& ip, const std::byte* end, size_t& length)
+{
+	uint8_t b;
+	do
+	{
+		if (ip == end)
+		{
+			return false;
+		}
+		b = static_cast<uint8_t>(*ip++);
+		length += b;
+	} while (b == 255);
+	return true;
+}
+}
+
+size_t CAM::Utils::LZ::Compress(const std::byte* src, size_t srcSize, std::byte* dst)
+{
+	std::byte* op = dst;
+	size_t anchor = 0;
+
+	auto emit = [&] (size_t literals, size_t offset, size_t matchLength)
+	{
+		size_t matchCode = matchLength == 0 ? 0 : matchLength - minMatch;
+		std::byte* token = op++;
+		*token = static_cast<std::byte>(((literals < 15 ? literals : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+		if (literals >= 15) { op = WriteLength(op, literals - 15); }
+		if (literals != 0)
+		{
+			std::memcpy(op, src + anchor, literals);
+			op += literals;
+		}
+
+		if (matchLength == 0)
+		{
+			return;
+		}
+
+		*op++ = static_cast<std::byte>(offset & 0xFF);
+		*op++ = static_cast<std::byte>(offset >> 8);
+		if (matchCode >= 15) { op = WriteLength(op, matchCode - 15); }
+	};
+
+	if (srcSize > matchLimit)
+	{
+		// Last place we saw each hash of four bytes.
+		std::array<uint32_t, 1 << hashBits> table = {};
+
+		size_t ip = 0;
+		size_t limit = srcSize - matchLimit;
+		while (ip < limit)
+		{
+			uint32_t sequence = Read32(src + ip);
+			uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+			size_t ref = table[hash];
+			table[hash] = static_cast<uint32_t>(ip);
+
+			if (ref >= ip || ip - ref > maxOffset || Read32(src + ref) != sequence)
+			{
+				++ip;
+				continue;
+			}
+
+			size_t matchLength = minMatch;
+			while (ip + matchLength < srcSize - lastLiterals && src[ref + matchLength] == src[ip + matchLength])
+			{
+				++matchLength;
+			}
+
+			emit(ip - anchor, ip - ref, matchLength);
+			ip += matchLength;
+			anchor = ip;
+		}
+	}
+
+	emit(srcSize - anchor, 0, 0);
+	return static_cast<size_t>(op - dst);
+}
+
+bool CAM::Utils::LZ::Decompress(const std::byte* src, size_t srcSize, std::byte* dst, size_t dstSize)
+{
+	const std::byte* ip = src;
+	const std::byte* end = src + srcSize;
+	std::byte* op = dst;
+	std::byte* opEnd = dst + dstSize;
+
+	while (ip != end)
+	{
+		uint8_t token = static_cast<uint8_t>(*ip++);
+
+		size_t literals = token >> 4;
+		if (literals == 15 && !ReadLength(ip, end, literals))
+		{
+			return false;
+		}
+		if (literals > static_cast<size_t>(end - ip) || literals > static_cast<size_t>(opEnd - op))
+		{
+			return false;
+		}
+		if (literals != 0)
+		{
+			std::memcpy(op, ip, literals);
+			ip += literals;
+			op += literals;
+		}
+
+		if (ip == end)
+		{
+			break; // The last sequence has no match
+		}
+
+		if (end - ip < 2)
+		{
+			return false;
+		}
+		size_t offset = static_cast<size_t>(ip[0]) | (static_cast<size_t>(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > static_cast<size_t>(op - dst))
+		{
+			return false;
+		}
+
+		size_t matchLength = token & 0xF;
+		if (matchLength == 15 && !ReadLength(ip, end, matchLength))
+		{
+			return false;
+		}
+		matchLength += minMatch;
+		if (matchLength > static_cast<size_t>(opEnd - op))
+		{
+			return false;
+		}
+
+		// Matches may overlap what they write, which repeats the pattern.
+		const std::byte* match = op - offset;
+		if (offset >= matchLength)
+		{
+			std::memcpy(op, match, matchLength);
+			op += matchLength;
+		}
+		else
+		{
+			for (size_t i = 0; i < matchLength; ++i)
+			{
+				*op++ = *match++;
+			}
+		}
+	}
+
+	return op == opEnd;
+}
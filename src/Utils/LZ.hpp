@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A small, fast LZ77 compressor in the style of LZ4's block format. Built for
+ * decompression speed over ratio, as assets are compressed once and
+ * decompressed every time the game starts.
+ *
+ * Each sequence is a token, whose high nibble is how many literals follow and
+ * low nibble how long the match after them is, less 4. A nibble of 15 means
+ * more length follows in bytes, each added on, till one isn't 255. Then the
+ * literals, then the match's offset back as two little endian bytes. The last
+ * sequence is just literals.
+ */
+
+#ifndef CAM_UTILS_LZ_HPP
+#define CAM_UTILS_LZ_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace CAM
+{
+namespace Utils
+{
+class LZ
+{
+	public:
+	// The most Compress can write for size bytes in.
+	[[nodiscard]] static inline size_t CompressBound(size_t size)
+	{
+		return size + size / 255 + 16;
+	}
+
+	// dst must have room for CompressBound(srcSize). Returns how much was
+	// written.
+	[[nodiscard]] static size_t Compress(const std::byte* src, size_t srcSize, std::byte* dst);
+
+	// dstSize must be exactly what was compressed. False if src is corrupt.
+	[[nodiscard]] static bool Decompress(const std::byte* src, size_t srcSize, std::byte* dst, size_t dstSize);
+
+	private:
+	static constexpr size_t minMatch = 4;
+	static constexpr size_t maxOffset = 65535;
+
+	// Matches must end this far from the end, so the last sequence always has
+	// a few literals.
+	static constexpr size_t lastLiterals = 5;
+	static constexpr size_t matchLimit = 12;
+
+	static constexpr size_t hashBits = 14;
+};
+}
+}
+
+#endif
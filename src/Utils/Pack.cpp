@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Pack.hpp"
+#include "LZ.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+
+CAM::Utils::PackReader::PackReader(std::string filename, MappedFile::Access access)
+	: file(std::move(filename), access)
+{
+	auto view = file.View();
+	if (view.size() < sizeof(PackHeader))
+	{
+		throw std::runtime_error("Pack is too small.");
+	}
+
+	auto header = reinterpret_cast<const PackHeader*>(view.data());
+	if (std::memcmp(header->magic, packMagic, sizeof(packMagic)) != 0 || header->version != packVersion)
+	{
+		throw std::runtime_error("Not a pack, or a pack of another version.");
+	}
+
+	// Checked once here, so Read and friends don't have to.
+	auto inFile = [&view] (uint64_t offset, uint64_t size)
+	{
+		return offset <= view.size() && size <= view.size() - offset;
+	};
+
+	if
+	(
+		header->indexOffset % alignof(PackEntry) != 0
+		|| !inFile(header->indexOffset, uint64_t{header->entryCount} * sizeof(PackEntry))
+		|| !inFile(header->namesOffset, header->namesSize)
+	)
+	{
+		throw std::runtime_error("Pack's index is out of bounds.");
+	}
+
+	entries = std::span<const PackEntry>
+	(
+		reinterpret_cast<const PackEntry*>(view.data() + header->indexOffset),
+		header->entryCount
+	);
+	names = reinterpret_cast<const char*>(view.data() + header->namesOffset);
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		auto& entry = entries[i];
+		if
+		(
+			!inFile(entry.offset, entry.storedSize)
+			|| uint64_t{entry.nameOffset} + entry.nameLength > header->namesSize
+			|| (i != 0 && entries[i - 1].hash > entry.hash)
+			|| ((entry.flags & PackEntry::Compressed) == 0 && entry.storedSize != entry.size)
+		)
+		{
+			throw std::runtime_error("Pack has a bad entry.");
+		}
+	}
+}
+
+const CAM::Utils::PackEntry* CAM::Utils::PackReader::Find(std::string_view name) const
+{
+	uint64_t hash = Hash(name);
+	auto it = std::lower_bound
+	(
+		std::begin(entries),
+		std::end(entries),
+		hash,
+		[] (const PackEntry& entry, uint64_t hash) { return entry.hash < hash; }
+	);
+
+	for (; it != std::end(entries) && it->hash == hash; ++it)
+	{
+		if (Name(*it) == name)
+		{
+			return &*it;
+		}
+	}
+
+	return nullptr;
+}
+
+std::string_view CAM::Utils::PackReader::Name(const PackEntry& entry) const
+{
+	return std::string_view(names + entry.nameOffset, entry.nameLength);
+}
+
+CAM::Utils::FileView CAM::Utils::PackReader::Stored(const PackEntry& entry) const
+{
+	return file.View(entry.offset, entry.storedSize);
+}
+
+void CAM::Utils::PackReader::Read(const PackEntry& entry, std::span<std::byte> out) const
+{
+	if (out.size() != entry.size)
+	{
+		throw std::runtime_error("Pack entry read into a buffer of the wrong size.");
+	}
+
+	auto stored = Stored(entry);
+	if ((entry.flags & PackEntry::Compressed) == 0)
+	{
+		std::memcpy(out.data(), stored.data(), stored.size());
+		return;
+	}
+
+	if (!LZ::Decompress(stored.data(), stored.size(), out.data(), out.size()))
+	{
+		throw std::runtime_error("Pack entry is corrupt.");
+	}
+}
+
+std::vector<std::byte> CAM::Utils::PackReader::Read(const PackEntry& entry) const
+{
+	std::vector<std::byte> out(entry.size);
+	Read(entry, out);
+	return out;
+}
+
+void CAM::Utils::PackReader::WillNeed(const PackEntry& entry) const
+{
+	file.WillNeed(entry.offset, entry.storedSize);
+}
+
+// FNV-1a
+uint64_t CAM::Utils::PackReader::Hash(std::string_view name)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : name)
+	{
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void CAM::Utils::PackWriter::Add(std::string name, std::vector<std::byte> data, bool compress)
+{
+	files.push_back(Pending{std::move(name), std::move(data), compress});
+}
+
+void CAM::Utils::PackWriter::Write(std::string filename)
+{
+	std::sort
+	(
+		std::begin(files),
+		std::end(files),
+		[] (const Pending& a, const Pending& b)
+		{
+			uint64_t ha = PackReader::Hash(a.name);
+			uint64_t hb = PackReader::Hash(b.name);
+			return ha != hb ? ha < hb : a.name < b.name;
+		}
+	);
+
+	for (size_t i = 1; i < files.size(); ++i)
+	{
+		if (files[i - 1].name == files[i].name)
+		{
+			throw std::runtime_error("Two files in a pack have the same name.");
+		}
+	}
+
+	auto align = [] (uint64_t offset) { return (offset + packAlignment - 1) & ~uint64_t{packAlignment - 1}; };
+
+	PackHeader header = {};
+	std::memcpy(header.magic, packMagic, sizeof(packMagic));
+	header.version = packVersion;
+	header.entryCount = static_cast<uint32_t>(files.size());
+	header.indexOffset = sizeof(PackHeader);
+	header.namesOffset = header.indexOffset + files.size() * sizeof(PackEntry);
+
+	std::vector<PackEntry> index(files.size());
+	std::string names;
+	std::vector<std::vector<std::byte>> stored(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		auto& file = files[i];
+		auto& entry = index[i];
+		entry.hash = PackReader::Hash(file.name);
+		entry.size = file.data.size();
+		entry.nameOffset = static_cast<uint32_t>(names.size());
+		entry.nameLength = static_cast<uint32_t>(file.name.size());
+		names += file.name;
+
+		if (file.compress)
+		{
+			stored[i].resize(LZ::CompressBound(file.data.size()));
+			stored[i].resize(LZ::Compress(file.data.data(), file.data.size(), stored[i].data()));
+		}
+		if (file.compress && stored[i].size() < file.data.size())
+		{
+			entry.flags |= PackEntry::Compressed;
+		}
+		else
+		{
+			stored[i] = std::move(file.data);
+		}
+		entry.storedSize = stored[i].size();
+	}
+	header.namesSize = names.size();
+
+	uint64_t offset = align(header.namesOffset + header.namesSize);
+	for (auto& entry : index)
+	{
+		entry.offset = offset;
+		offset = align(offset + entry.storedSize);
+	}
+
+	FILE* out = fopen(filename.c_str(), "wb");
+	if (out == NULL)
+	{
+		throw std::runtime_error("Failed to open pack for writing.");
+	}
+
+	uint64_t written = 0;
+	bool ok = true;
+	auto write = [&] (const void* data, size_t size)
+	{
+		ok = ok && fwrite(data, 1, size, out) == size;
+		written += size;
+	};
+	auto padTo = [&] (uint64_t to)
+	{
+		static const char zeros[packAlignment] = {};
+		write(zeros, to - written);
+	};
+
+	write(&header, sizeof(header));
+	write(index.data(), index.size() * sizeof(PackEntry));
+	write(names.data(), names.size());
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		padTo(index[i].offset);
+		write(stored[i].data(), stored[i].size());
+	}
+
+	ok = fclose(out) == 0 && ok;
+	if (!ok)
+	{
+		throw std::runtime_error("Failed to write pack.");
+	}
+
+	files.clear();
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Packs, many files in one, so loading thousands of assets is one open and one
+ * mmap instead of thousands of each.
+ *
+ * A pack is laid out as:
+ *	- a PackHeader,
+ *	- the index, a PackEntry per file sorted by the hash of its name,
+ *	- every name, back to back,
+ *	- every file's data, each starting on a packAlignment boundary.
+ *
+ * Files are stored LZ compressed, unless that didn't make them smaller. All
+ * numbers are little endian, which is to say we read them as is.
+ *
+ * Build them with PackWriter, or the CAMPack tool. See Jobs/PackLoad.hpp for
+ * reading lots of files at once.
+ */
+
+#ifndef CAM_UTILS_PACK_HPP
+#define CAM_UTILS_PACK_HPP
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+#include <cstdint>
+#include <cstddef>
+
+#include "File.hpp"
+
+namespace CAM
+{
+namespace Utils
+{
+static constexpr char packMagic[8] = {'C', 'A', 'M', 'P', 'A', 'C', 'K', '\0'};
+static constexpr uint32_t packVersion = 1;
+static constexpr size_t packAlignment = 4096;
+
+struct PackHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t entryCount;
+	uint64_t indexOffset;
+	uint64_t namesOffset;
+	uint64_t namesSize;
+	uint8_t reserved[24];
+};
+static_assert(sizeof(PackHeader) == 64, "PackHeader is part of the file format.");
+
+struct PackEntry
+{
+	enum Flags : uint32_t
+	{
+		Compressed = 1 << 0,
+	};
+
+	uint64_t hash;
+	uint64_t offset;
+	uint64_t storedSize; // What's in the pack
+	uint64_t size; // What it decompresses to
+	uint32_t nameOffset; // Into the names
+	uint32_t nameLength;
+	uint32_t flags;
+	uint32_t reserved;
+};
+static_assert(sizeof(PackEntry) == 48, "PackEntry is part of the file format.");
+
+class PackReader
+{
+	public:
+	// Throws if the pack is malformed.
+	PackReader(std::string filename, MappedFile::Access access = MappedFile::Access::Random);
+
+	PackReader(const PackReader&) = delete;
+	PackReader(PackReader&&) = delete;
+	PackReader& operator=(const PackReader&)& = delete;
+	PackReader& operator=(PackReader&&)& = delete;
+
+	// nullptr if there's no such file. Valid for as long as we are.
+	[[nodiscard]] const PackEntry* Find(std::string_view name) const;
+
+	[[nodiscard]] inline std::span<const PackEntry> Entries() const { return entries; }
+	[[nodiscard]] std::string_view Name(const PackEntry& entry) const;
+
+	// The entry as it's stored, straight out of the mapping. So no copies if
+	// it isn't compressed.
+	[[nodiscard]] FileView Stored(const PackEntry& entry) const;
+
+	// Decompresses, or copies, the entry into out, which must be entry.size
+	// bytes. Throws if the entry is corrupt. Safe from any thread.
+	void Read(const PackEntry& entry, std::span<std::byte> out) const;
+	[[nodiscard]] std::vector<std::byte> Read(const PackEntry& entry) const;
+
+	// Starts reading the entry in, so it's there by the time we Read it.
+	void WillNeed(const PackEntry& entry) const;
+
+	[[nodiscard]] static uint64_t Hash(std::string_view name);
+
+	private:
+	MappedFile file;
+	std::span<const PackEntry> entries;
+	const char* names = nullptr;
+};
+
+class PackWriter
+{
+	public:
+	// Uncompressed data is stored as is, compressed data only if that made it
+	// smaller.
+	void Add(std::string name, std::vector<std::byte> data, bool compress = true);
+
+	// Throws if it can't, or if two files have the same name.
+	void Write(std::string filename);
+
+	private:
+	struct Pending
+	{
+		std::string name;
+		std::vector<std::byte> data;
+		bool compress;
+	};
+
+	std::vector<Pending> files;
+};
+}
+}
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+std::mutex CAM::Utils::Profiler::threadsMutex;
+std::vector<std::unique_ptr<CAM::Utils::Profiler::ThreadBuffer>> CAM::Utils::Profiler::threads;
+const uint64_t CAM::Utils::Profiler::startTicks = CAM::Utils::Profiler::Ticks();
+const std::chrono::steady_clock::time_point CAM::Utils::Profiler::startTime = std::chrono::steady_clock::now();
+
+namespace
+{
+void WriteEscaped(FILE* file, const std::string& str)
+{
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+		{
+			fprintf(file, "\\%c", c);
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			fprintf(file, "\\u%04x", static_cast<unsigned>(c));
+		}
+		else
+		{
+			fputc(c, file);
+		}
+	}
+}
+}
+
+CAM::Utils::Profiler::ThreadBuffer* CAM::Utils::Profiler::Register()
+{
+	auto buffer = std::make_unique<ThreadBuffer>();
+	buffer->zones = std::make_unique<Zone[]>(zoneCount);
+
+	std::unique_lock<std::mutex> lock(threadsMutex);
+	buffer->tid = static_cast<uint32_t>(threads.size() + 1);
+	buffer->name = "Thread " + std::to_string(buffer->tid);
+	threads.push_back(std::move(buffer));
+
+	local = threads.back().get();
+	return local;
+}
+
+void CAM::Utils::Profiler::SetThreadName(std::string name)
+{
+	auto buffer = local;
+	if (buffer == nullptr)
+	{
+		buffer = Register();
+	}
+
+	std::unique_lock<std::mutex> lock(threadsMutex);
+	buffer->name = std::move(name);
+}
+
+void CAM::Utils::Profiler::WriteChromeTrace(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+	{
+		throw std::runtime_error("Failed to open trace file.");
+	}
+
+	double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+	double ticksPerUs = elapsedUs > 0 ? static_cast<double>(Ticks() - startTicks) / elapsedUs : 1;
+
+	auto toUs = [ticksPerUs] (uint64_t ticks)
+	{
+		return ticks < startTicks ? 0. : static_cast<double>(ticks - startTicks) / ticksPerUs;
+	};
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first = true;
+
+	std::unique_lock<std::mutex> lock(threadsMutex);
+	for (auto& buffer : threads)
+	{
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", first ? "" : ",\n", buffer->tid);
+		WriteEscaped(file, buffer->name);
+		fprintf(file, "\"}}");
+		first = false;
+
+		// Its thread keeps writing while we read. Zones more than a ring
+		// behind head are gone, and any more we read may have been overwritten
+		// from under us, as told by where head got to once we were done.
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		uint64_t from = std::max(buffer->read, head > zoneCount ? head - zoneCount : 0);
+
+		struct Read
+		{
+			const char* name;
+			uint64_t begin;
+			uint64_t end;
+		};
+		std::vector<Read> read;
+		read.reserve(head - from);
+		for (uint64_t i = from; i < head; ++i)
+		{
+			auto& zone = buffer->zones[i & zoneMask];
+			read.push_back(Read
+			{
+				zone.name.load(std::memory_order_relaxed),
+				zone.begin.load(std::memory_order_relaxed),
+				zone.end.load(std::memory_order_relaxed)
+			});
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t headAfter = buffer->head.load(std::memory_order_relaxed);
+		uint64_t valid = headAfter >= zoneCount ? headAfter - zoneCount + 1 : 0;
+		buffer->read = head;
+
+		for (uint64_t i = std::max(from, valid); i < head; ++i)
+		{
+			auto& zone = read[i - from];
+			fprintf(file, ",\n{\"name\":\"");
+			WriteEscaped(file, zone.name);
+			fprintf
+			(
+				file,
+				"\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				buffer->tid,
+				toUs(zone.begin),
+				toUs(zone.end) - toUs(zone.begin)
+			);
+		}
+	}
+	lock.unlock();
+
+	fprintf(file, "\n]}\n");
+	bool failed = ferror(file) != 0;
+	if (fclose(file) != 0 || failed)
+	{
+		throw std::runtime_error("Failed to write trace file.");
+	}
+}
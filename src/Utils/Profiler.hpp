@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A CPU profiler. CAM_PROFILE_SCOPE("Name") times from where it is to the end
+ * of its scope. Zones inside zones nest, as zones on the same thread nest by
+ * time in the trace. Workers put one around every job they run.
+ *
+ * Each thread writes its zones into its own ring, without locks, and
+ * WriteChromeTrace empties every ring into a Chrome trace/Perfetto JSON file,
+ * whenever you like. Rings hold Config::ProfilerZonesPerThread zones, older
+ * ones are overwritten if you don't empty them in time.
+ *
+ * Only there if built with CAM_RE_PROFILE defined, see the CMake option of the
+ * same name. Otherwise the macros are nothing, and traces are empty.
+ *
+ * Names must outlive the program, so stick to string literals. A zone in a job
+ * which waits on another job spans whatever the worker ran meanwhile.
+ */
+
+#ifndef CAM_UTILS_PROFILER_HPP
+#define CAM_UTILS_PROFILER_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../Config.hpp"
+
+#ifdef CAM_RE_PROFILE
+#define CAM_PROFILE_CONCAT_IMPL(a, b) a##b
+#define CAM_PROFILE_CONCAT(a, b) CAM_PROFILE_CONCAT_IMPL(a, b)
+#define CAM_PROFILE_SCOPE(name) ::CAM::Utils::Profiler::Scope CAM_PROFILE_CONCAT(camProfileScope, __LINE__)(name)
+#define CAM_PROFILE_THREAD(name) ::CAM::Utils::Profiler::SetThreadName(name)
+#else
+#define CAM_PROFILE_SCOPE(name)
+#define CAM_PROFILE_THREAD(name)
+#endif
+
+namespace CAM
+{
+namespace Utils
+{
+class Profiler
+{
+	public:
+#ifdef CAM_RE_PROFILE
+	static constexpr bool Enabled = true;
+#else
+	static constexpr bool Enabled = false;
+#endif
+
+	class Scope
+	{
+		public:
+		inline explicit Scope(const char* name) : name(name), begin(Ticks()) {}
+		inline ~Scope() { Record(name, begin, Ticks()); }
+
+		Scope(const Scope&) = delete;
+		Scope(Scope&&) = delete;
+		Scope& operator=(const Scope&)& = delete;
+		Scope& operator=(Scope&&)& = delete;
+
+		private:
+		const char* name;
+		uint64_t begin;
+	};
+
+	// What the trace calls this thread.
+	static void SetThreadName(std::string name);
+
+	// Writes every zone finished since the last call. Throws if path can't be
+	// written to.
+	static void WriteChromeTrace(const std::string& path);
+
+	// The TSC where we have one, as reading it is far cheaper than asking the
+	// OS. Converted to time when writing the trace.
+	[[nodiscard]] static inline uint64_t Ticks()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	static inline void Record(const char* name, uint64_t begin, uint64_t end)
+	{
+		auto buffer = local;
+		if (buffer == nullptr)
+		{
+			buffer = Register();
+		}
+
+		// Only we write to our ring, so no need for RMWs. The fence keeps a
+		// reader from seeing this zone's slot change without seeing head move
+		// on to it first, see WriteChromeTrace.
+		uint64_t index = buffer->head.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		auto& zone = buffer->zones[index & zoneMask];
+		zone.name.store(name, std::memory_order_relaxed);
+		zone.begin.store(begin, std::memory_order_relaxed);
+		zone.end.store(end, std::memory_order_relaxed);
+
+		buffer->head.store(index + 1, std::memory_order_release);
+	}
+
+	private:
+	static_assert
+	(
+		(Config::ProfilerZonesPerThread & (Config::ProfilerZonesPerThread - 1)) == 0,
+		"ProfilerZonesPerThread must be a power of two."
+	);
+	static constexpr uint64_t zoneCount = Config::ProfilerZonesPerThread;
+	static constexpr uint64_t zoneMask = zoneCount - 1;
+
+	struct Zone
+	{
+		std::atomic<const char*> name;
+		std::atomic<uint64_t> begin;
+		std::atomic<uint64_t> end;
+	};
+
+	struct ThreadBuffer
+	{
+		std::unique_ptr<Zone[]> zones;
+
+		// Zones ever written. Zone i lives in zones[i & zoneMask].
+		alignas(64) std::atomic<uint64_t> head = 0;
+
+		// Only touched by WriteChromeTrace, under its lock.
+		alignas(64) uint64_t read = 0;
+		uint32_t tid;
+		std::string name;
+	};
+
+	[[nodiscard]] static ThreadBuffer* Register();
+
+	static inline thread_local ThreadBuffer* local = nullptr;
+
+	// Every thread's, even those gone, so what they did still gets written.
+	static std::mutex threadsMutex;
+	static std::vector<std::unique_ptr<ThreadBuffer>> threads;
+
+	// What Ticks are in time is worked out from how many went by since these.
+	static const uint64_t startTicks;
+	static const std::chrono::steady_clock::time_point startTime;
+};
+}
+}
+
+#endif
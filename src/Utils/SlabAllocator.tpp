@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A slab allocator for Ts, handing out cache line aligned memory for one T at a
+ * time. Use it from T's operator new and delete.
+ *
+ * Each thread keeps two magazines, lists of up to magazineSize free slots,
+ * which it allocates from and frees into without any synchronization. When
+ * both are full, or both are empty, it trades a whole magazine with the depot,
+ * a lock-free array of full magazines shared by every thread. So memory freed
+ * on one thread flows back to threads which allocate, magazineSize slots at a
+ * time. Only when the depot is dry do we go to the system, for
+ * growMagazines magazines at once.
+ *
+ * Call Reserve at startup so we don't have to.
+ */
+
+#ifndef CAM_UTILS_SLABALLOCATOR_TPP
+#define CAM_UTILS_SLABALLOCATOR_TPP
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdint>
+
+namespace CAM
+{
+namespace Utils
+{
+template<typename T, size_t magazineSize = 64, size_t depotSlots = 256, size_t growMagazines = 16>
+class SlabAllocator
+{
+	public:
+	static_assert(magazineSize != 0, "Magazines must hold something.");
+
+	[[nodiscard]] static inline SlabAllocator& Get()
+	{
+		static SlabAllocator allocator;
+		return allocator;
+	}
+
+	SlabAllocator(const SlabAllocator&) = delete;
+	SlabAllocator(SlabAllocator&&) = delete;
+	SlabAllocator& operator=(const SlabAllocator&)& = delete;
+	SlabAllocator& operator=(SlabAllocator&&)& = delete;
+
+	// Everything must have been freed by now. We go after every thread's
+	// magazines, including the main thread's.
+	inline ~SlabAllocator()
+	{
+		for (auto slab : slabs)
+		{
+			::operator delete(slab, std::align_val_t(alignof(Node)));
+		}
+	}
+
+	// Makes sure count slots have been allocated in total, rounded up to
+	// whole magazines.
+	inline void Reserve(size_t count)
+	{
+		size_t magazines = (count + magazineSize - 1) / magazineSize;
+		size_t have = slotsAllocated.load(std::memory_order_acquire) / magazineSize;
+		if (magazines > have)
+		{
+			PushDepot(Grow(magazines - have));
+		}
+	}
+
+	[[nodiscard]] inline void* Allocate()
+	{
+		auto& cache = Cache();
+		if (cache.loaded.count == 0)
+		{
+			if (cache.previous.count != 0)
+			{
+				std::swap(cache.loaded, cache.previous);
+			}
+			else
+			{
+				cache.loaded = Magazine{PopDepot(), magazineSize};
+				if (cache.loaded.head == nullptr)
+				{
+					cache.loaded = Magazine{Grow(growMagazines), magazineSize};
+				}
+			}
+		}
+
+		Node* node = cache.loaded.head;
+		cache.loaded.head = node->next;
+		--cache.loaded.count;
+		return node;
+	}
+
+	inline void Free(void* p)
+	{
+		if (p == nullptr)
+		{
+			return;
+		}
+
+		auto& cache = Cache();
+		if (cache.loaded.count == magazineSize)
+		{
+			if (cache.previous.count == magazineSize)
+			{
+				PushDepot(cache.previous.head);
+			}
+			cache.previous = cache.loaded;
+			cache.loaded = Magazine{};
+		}
+
+		Node* node = static_cast<Node*>(p);
+		node->next = cache.loaded.head;
+		cache.loaded.head = node;
+		++cache.loaded.count;
+	}
+
+	// How many slots we've asked the system for, so you can check Reserve
+	// was big enough.
+	[[nodiscard]] inline size_t SlotsAllocated() const
+	{
+		return slotsAllocated.load(std::memory_order_relaxed);
+	}
+
+	private:
+	union Node
+	{
+		Node* next;
+		alignas(alignof(T) > 64 ? alignof(T) : 64) unsigned char storage[sizeof(T)];
+	};
+
+	struct Magazine
+	{
+		Node* head = nullptr;
+		size_t count = 0;
+	};
+
+	struct ThreadCache
+	{
+		Magazine loaded;
+		Magazine previous;
+
+		// Hands our free slots back once the thread dies.
+		inline ~ThreadCache()
+		{
+			auto& allocator = SlabAllocator::Get();
+			for (auto* magazine : {&loaded, &previous})
+			{
+				while (magazine->head != nullptr)
+				{
+					Node* node = magazine->head;
+					magazine->head = node->next;
+					allocator.FreeOrphan(node);
+				}
+			}
+		}
+	};
+
+	SlabAllocator() = default;
+
+	[[nodiscard]] static inline ThreadCache& Cache()
+	{
+		static thread_local ThreadCache cache;
+		return cache;
+	}
+
+	// Returns one full magazine and puts the rest in the depot.
+	[[nodiscard]] Node* Grow(size_t magazines)
+	{
+		size_t count = magazines * magazineSize;
+		auto slab = static_cast<Node*>(::operator new(count * sizeof(Node), std::align_val_t(alignof(Node))));
+		{
+			std::unique_lock<std::mutex> lock(slabsMutex);
+			slabs.push_back(slab);
+		}
+		slotsAllocated.fetch_add(count, std::memory_order_release);
+
+		for (size_t m = 0; m < magazines; ++m)
+		{
+			Node* first = slab + m * magazineSize;
+			for (size_t i = 0; i + 1 < magazineSize; ++i)
+			{
+				first[i].next = &first[i + 1];
+			}
+			first[magazineSize - 1].next = nullptr;
+
+			if (m != 0)
+			{
+				PushDepot(first);
+			}
+		}
+
+		return slab;
+	}
+
+	// Takes a magazine of exactly magazineSize nodes.
+	inline void PushDepot(Node* magazine)
+	{
+		for (auto& slot : depot)
+		{
+			Node* expected = nullptr;
+			if
+			(
+				slot.load(std::memory_order_relaxed) == nullptr
+				&& slot.compare_exchange_strong(expected, magazine, std::memory_order_release, std::memory_order_relaxed)
+			)
+			{
+				depotSize.fetch_add(1, std::memory_order_release);
+				return;
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(overflowMutex);
+		overflow.push_back(magazine);
+		overflowSize.store(overflow.size(), std::memory_order_release);
+	}
+
+	[[nodiscard]] inline Node* PopDepot()
+	{
+		if (depotSize.load(std::memory_order_acquire) != 0)
+		{
+			for (auto& slot : depot)
+			{
+				if (slot.load(std::memory_order_relaxed) == nullptr)
+				{
+					continue;
+				}
+
+				Node* magazine = slot.exchange(nullptr, std::memory_order_acquire);
+				if (magazine != nullptr)
+				{
+					depotSize.fetch_sub(1, std::memory_order_relaxed);
+					return magazine;
+				}
+			}
+		}
+
+		if (overflowSize.load(std::memory_order_acquire) != 0)
+		{
+			std::unique_lock<std::mutex> lock(overflowMutex);
+			if (!overflow.empty())
+			{
+				Node* magazine = overflow.back();
+				overflow.pop_back();
+				overflowSize.store(overflow.size(), std::memory_order_release);
+				return magazine;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// For dying threads, whose partial magazines can't go in the depot.
+	inline void FreeOrphan(Node* node)
+	{
+		std::unique_lock<std::mutex> lock(orphansMutex);
+		node->next = orphans.head;
+		orphans.head = node;
+		if (++orphans.count == magazineSize)
+		{
+			PushDepot(orphans.head);
+			orphans = Magazine{};
+		}
+	}
+
+	alignas(64) std::array<std::atomic<Node*>, depotSlots> depot = {};
+	alignas(64) std::atomic<size_t> depotSize = 0;
+	std::atomic<size_t> slotsAllocated = 0;
+
+	std::mutex overflowMutex;
+	std::atomic<size_t> overflowSize = 0;
+	std::vector<Node*> overflow;
+
+	std::mutex orphansMutex;
+	Magazine orphans;
+
+	std::mutex slabsMutex;
+	std::vector<Node*> slabs;
+};
+}
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A lock-free Chase-Lev work-stealing deque of T*s. See:
+ *	https://www.di.ens.fr/~zappa/readings/ppopp13.pdf
+ *
+ * Only the owning thread may call Push and Pop, which work on the bottom end
+ * (LIFO). Any thread may call Steal, which takes from the top end (FIFO).
+ *
+ * The buffer grows when full. Old buffers are kept around till the deque dies
+ * since a thief might still be reading from them, they are at most as big as
+ * the current buffer combined.
+ */
+
+#ifndef CAM_UTILS_WORKSTEALINGDEQUE_TPP
+#define CAM_UTILS_WORKSTEALINGDEQUE_TPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace CAM
+{
+namespace Utils
+{
+template<typename T>
+class WorkStealingDeque
+{
+	private:
+	class Buffer
+	{
+		public:
+		Buffer(int64_t capacity)
+			: capacity(capacity), mask(capacity - 1), data(new std::atomic<T*>[capacity])
+		{}
+
+		[[nodiscard]] inline T* Get(int64_t i) const
+		{
+			return data[i & mask].load(std::memory_order_relaxed);
+		}
+
+		inline void Put(int64_t i, T* item)
+		{
+			data[i & mask].store(item, std::memory_order_relaxed);
+		}
+
+		[[nodiscard]] inline std::unique_ptr<Buffer> Grow(int64_t bottom, int64_t top) const
+		{
+			auto ret = std::make_unique<Buffer>(capacity * 2);
+			for (int64_t i = top; i != bottom; ++i)
+			{
+				ret->Put(i, Get(i));
+			}
+			return ret;
+		}
+
+		const int64_t capacity;
+
+		private:
+		const int64_t mask;
+		std::unique_ptr<std::atomic<T*>[]> data;
+	};
+
+	public:
+	// initialCapacity must be a power of two
+	WorkStealingDeque(int64_t initialCapacity = 256)
+	{
+		buffers.push_back(std::make_unique<Buffer>(initialCapacity));
+		buffer.store(buffers.back().get(), std::memory_order_relaxed);
+	}
+
+	WorkStealingDeque(const WorkStealingDeque&) = delete;
+	WorkStealingDeque(WorkStealingDeque&&) = delete;
+	WorkStealingDeque& operator=(const WorkStealingDeque&)& = delete;
+	WorkStealingDeque& operator=(WorkStealingDeque&&)& = delete;
+
+	// Owner only
+	inline void Push(T* item)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		Buffer* buf = buffer.load(std::memory_order_relaxed);
+
+		if (b - t > buf->capacity - 1)
+		{
+			buffers.push_back(buf->Grow(b, t));
+			buf = buffers.back().get();
+			buffer.store(buf, std::memory_order_release);
+		}
+
+		buf->Put(b, item);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	// Owner only. Returns nullptr if empty.
+	[[nodiscard]] inline T* Pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		Buffer* buf = buffer.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			// Was empty
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		T* ret = buf->Get(b);
+		if (t == b)
+		{
+			// Last item, race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				ret = nullptr;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		return ret;
+	}
+
+	// Any thread. Returns nullptr if empty or if we lost a race.
+	[[nodiscard]] inline T* Steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+		{
+			return nullptr;
+		}
+
+		Buffer* buf = buffer.load(std::memory_order_acquire);
+		T* ret = buf->Get(t);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			return nullptr;
+		}
+
+		return ret;
+	}
+
+	// Any thread, only a hint if not called from the owner.
+	[[nodiscard]] inline size_t Size() const
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_relaxed);
+		return b > t ? (size_t)(b - t) : 0;
+	}
+
+	[[nodiscard]] inline bool Empty() const { return Size() == 0; }
+
+	private:
+	alignas(64) std::atomic<int64_t> top = 0;
+	alignas(64) std::atomic<int64_t> bottom = 0;
+	std::atomic<Buffer*> buffer;
+
+	// Owner only
+	std::vector<std::unique_ptr<Buffer>> buffers;
+};
+}
+}
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks a FrameArena hands the same memory out again once a frame's slot
+ * comes back round in BeginFrame, and that a JobGraph run once per frame does
+ * its allocating through the scratch resource it's given.
+ */
+
+#include "../src/Jobs/Job.hpp"
+#include "../src/Jobs/JobGraph.tpp"
+#include "../src/Jobs/Worker.hpp"
+#include "../src/Jobs/WorkerPool.hpp"
+#include "../src/Utils/FrameArena.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace
+{
+constexpr size_t framesInFlight = 2;
+constexpr uint64_t frames = 16;
+
+bool Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FrameArenaTest: %s\n", what);
+	}
+	return condition;
+}
+
+// Counts what goes through it on its way to the arena.
+class CountingResource : public std::pmr::memory_resource
+{
+	public:
+	inline explicit CountingResource(std::pmr::memory_resource* upstream) : upstream(upstream) {}
+
+	std::atomic<size_t> allocations = 0;
+
+	private:
+	inline void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		return upstream->allocate(bytes, alignment);
+	}
+	inline void do_deallocate(void* p, size_t bytes, size_t alignment) override { upstream->deallocate(p, bytes, alignment); }
+	inline bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+	std::pmr::memory_resource* upstream;
+};
+
+bool ReuseAcrossBeginFrame()
+{
+	CAM::Utils::FrameArena arena(framesInFlight, 4096);
+
+	std::vector<std::byte*> small;
+	std::vector<std::byte*> large;
+	for (uint64_t frame = 0; frame < framesInFlight * 2; ++frame)
+	{
+		arena.BeginFrame(frame);
+
+		std::pmr::vector<uint32_t> values(arena.Resource());
+		values.resize(100, static_cast<uint32_t>(frame));
+		small.push_back(reinterpret_cast<std::byte*>(values.data()));
+
+		// Bigger than a block, so it gets its own.
+		large.push_back(static_cast<std::byte*>(arena.Allocate(10000, 64)));
+	}
+
+	bool ok = true;
+	for (size_t frame = 0; frame < framesInFlight; ++frame)
+	{
+		ok &= Check(small[frame] != small[frame + 1], "frames in flight at once shared memory.");
+		ok &= Check(small[frame] == small[frame + framesInFlight], "a block wasn't reused once its frame came back round.");
+		ok &= Check(large[frame] == large[frame + framesInFlight], "a large block wasn't reused once its frame came back round.");
+	}
+	return ok;
+}
+
+struct GraphParams
+{
+	uint64_t frame;
+};
+
+CAM::Utils::FrameArena graphArena(framesInFlight, 4096);
+CountingResource scratch(graphArena.Resource());
+CAM::Jobs::JobGraph<GraphParams> graph;
+std::atomic<uint32_t> stages[frames];
+std::atomic<uint64_t> framesRun = 0;
+
+void RecordGraph()
+{
+	auto a = graph.AddNode([] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*, const GraphParams& p) { stages[p.frame] += 1; });
+	auto b = graph.AddNode([] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*, const GraphParams& p) { stages[p.frame] += 10; });
+	auto c = graph.AddNode([] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*, const GraphParams& p) { stages[p.frame] += 100; });
+	auto d = graph.AddNode
+	(
+		[] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*, const GraphParams& p)
+		{
+			if (stages[p.frame].load() == 111)
+			{
+				framesRun.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	);
+	graph.AddEdge(a, b);
+	graph.AddEdge(a, c);
+	graph.AddEdge(b, d);
+	graph.AddEdge(c, d);
+}
+
+// Like Main::FrameStart, each frame only starts once the last is done.
+void Frame(CAM::Jobs::WorkerPool* wp, CAM::Jobs::Job* thisJob, uint64_t frame)
+{
+	if (frame == frames)
+	{
+		return;
+	}
+
+	graphArena.BeginFrame(frame);
+
+	auto next = wp->GetJob
+	(
+		[frame] (CAM::Jobs::WorkerPool* wp, size_t, CAM::Jobs::Job* thisJob)
+		{
+			Frame(wp, thisJob, frame + 1);
+		},
+		0,
+		false
+	);
+	next->SameThingsDependOnMeAs(thisJob);
+
+	auto body = wp->GetJob
+	(
+		[frame] (CAM::Jobs::WorkerPool* wp, size_t, CAM::Jobs::Job* thisJob)
+		{
+			graph.Instantiate(wp, GraphParams{frame}, thisJob, &scratch);
+		},
+		1,
+		false
+	);
+	next->DependsOn(body.get());
+
+	if (!wp->SubmitJob(std::move(body))) { throw std::runtime_error("Could not submit job\n"); }
+	if (!wp->SubmitJob(std::move(next))) { throw std::runtime_error("Could not submit job\n"); }
+}
+
+bool GraphOnArena()
+{
+	CAM::Jobs::WorkerPool wp;
+
+	auto mainWorkerUni = std::make_unique<CAM::Jobs::Worker>(&wp, false);
+	auto mainWorker = mainWorkerUni.get();
+	wp.AddWorker(std::move(mainWorkerUni));
+	for (size_t i = 0; i < 3; ++i)
+	{
+		wp.AddWorker(std::make_unique<CAM::Jobs::Worker>(&wp, true));
+	}
+	wp.StartWorkers();
+
+	RecordGraph();
+	auto first = wp.GetJob
+	(
+		[] (CAM::Jobs::WorkerPool* wp, size_t, CAM::Jobs::Job* thisJob)
+		{
+			Frame(wp, thisJob, 0);
+		},
+		0,
+		false
+	);
+	if (!wp.SubmitJob(std::move(first))) { throw std::runtime_error("Could not submit job\n"); }
+
+	mainWorker->WorkerRoutine();
+
+	bool ok = true;
+	ok &= Check(framesRun.load() == frames, "the graph didn't run in order every frame.");
+	ok &= Check(scratch.allocations.load() != 0, "the graph didn't allocate from its scratch resource.");
+	return ok;
+}
+}
+
+int main()
+{
+	bool ok = ReuseAcrossBeginFrame();
+	ok &= GraphOnArena();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2018 Hal Gentz
+ *
+ * This file is part of CAM-RE.
+ *
+ * CAM-RE is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Bash is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * CAM-RE. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Churns through lots of jobs while a blocking job and a compute job both
+ * take their time, and checks finished jobs still get back to the slab, so it
+ * stays bounded. Long jobs used to pin the epoch, and the slab grew by every
+ * job run meanwhile.
+ */
+
+#include "../src/Jobs/Job.hpp"
+#include "../src/Jobs/Worker.hpp"
+#include "../src/Jobs/WorkerPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr size_t rounds = 2000;
+constexpr size_t jobsPerRound = 256;
+
+// Far below the rounds * jobsPerRound slots we'd need if nothing were ever
+// reclaimed.
+constexpr size_t slotBound = CAM::Config::JobSlabReserve + rounds * jobsPerRound / 8;
+
+std::atomic<bool> churnDone = false;
+std::atomic<size_t> peakSlots = 0;
+std::atomic<size_t> jobsRun = 0;
+
+void WaitForChurn()
+{
+	auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	while (!churnDone.load(std::memory_order_acquire) && std::chrono::steady_clock::now() < giveUp)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void Round(CAM::Jobs::WorkerPool* wp, CAM::Jobs::Job* thisJob, size_t left)
+{
+	size_t slots = CAM::Jobs::Job::Slab::Get().SlotsAllocated();
+	size_t peak = peakSlots.load(std::memory_order_relaxed);
+	while (slots > peak && !peakSlots.compare_exchange_weak(peak, slots, std::memory_order_relaxed)) {}
+
+	if (left == 0)
+	{
+		churnDone.store(true, std::memory_order_release);
+		return;
+	}
+
+	auto next = wp->GetJob
+	(
+		[left] (CAM::Jobs::WorkerPool* wp, size_t, CAM::Jobs::Job* thisJob)
+		{
+			Round(wp, thisJob, left - 1);
+		},
+		0,
+		false
+	);
+	next->SameThingsDependOnMeAs(thisJob);
+
+	std::vector<std::unique_ptr<CAM::Jobs::Job>> batch;
+	for (size_t i = 0; i < jobsPerRound; ++i)
+	{
+		auto job = wp->GetJob
+		(
+			[] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*)
+			{
+				jobsRun.fetch_add(1, std::memory_order_relaxed);
+			},
+			1,
+			false
+		);
+		next->DependsOn(job.get());
+		batch.push_back(std::move(job));
+	}
+
+	if (!wp->SubmitJob(std::move(next))) { throw std::runtime_error("Could not submit job\n"); }
+	if (!wp->SubmitJobs(batch)) { throw std::runtime_error("Could not submit job\n"); }
+}
+}
+
+int main()
+{
+	CAM::Jobs::WorkerPool wp;
+
+	auto mainWorkerUni = std::make_unique<CAM::Jobs::Worker>(&wp, false);
+	auto mainWorker = mainWorkerUni.get();
+	wp.AddWorker(std::move(mainWorkerUni));
+	for (size_t i = 0; i < 3; ++i)
+	{
+		wp.AddWorker(std::make_unique<CAM::Jobs::Worker>(&wp, true));
+	}
+
+	wp.StartWorkers();
+	wp.StartBlockingWorkers(2, 16);
+
+	auto blocking = wp.GetJob([] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*) { WaitForChurn(); }, 0, false);
+	blocking->SetBlocking();
+	if (!wp.SubmitJob(std::move(blocking))) { throw std::runtime_error("Could not submit job\n"); }
+
+	auto compute = wp.GetJob([] (CAM::Jobs::WorkerPool*, size_t, CAM::Jobs::Job*) { WaitForChurn(); }, 0, false);
+	if (!wp.SubmitJob(std::move(compute))) { throw std::runtime_error("Could not submit job\n"); }
+
+	auto first = wp.GetJob
+	(
+		[] (CAM::Jobs::WorkerPool* wp, size_t, CAM::Jobs::Job* thisJob)
+		{
+			Round(wp, thisJob, rounds);
+		},
+		0,
+		false
+	);
+	if (!wp.SubmitJob(std::move(first))) { throw std::runtime_error("Could not submit job\n"); }
+
+	mainWorker->WorkerRoutine();
+
+	if (!churnDone.load(std::memory_order_acquire) || jobsRun.load() != rounds * jobsPerRound)
+	{
+		printf("JobSlabTest: only ran %zu of %zu jobs.\n", jobsRun.load(), rounds * jobsPerRound);
+		return 1;
+	}
+
+	if (peakSlots.load() > slotBound)
+	{
+		printf("JobSlabTest: the slab grew to %zu slots, more than %zu.\n", peakSlots.load(), slotBound);
+		return 1;
+	}
+
+	printf("JobSlabTest: the slab peaked at %zu slots.\n", peakSlots.load());
+	return 0;
+}